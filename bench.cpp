@@ -0,0 +1,1106 @@
+// Benchmarks for the Where evaluator.
+//
+// Build: g++ -std=c++11 -O2 -pthread bench.cpp -o bench
+// Usage: ./bench trigram|regexp|match|incremental|cache|count|columnar|rowgroup|io|stream|arena|analyze [rows]
+//        rows defaults to 10M, except 2000 for match and 100 for arena
+//        ./bench matrix [rows] [repetitions]
+
+#define WHERE_NO_MAIN
+#include "where.cpp"
+
+#include <algorithm> // sort
+#include <chrono>    // steady_clock
+#include <cstdio>    // remove, snprintf
+#include <cstdlib>   // atol
+#include <fstream>   // ifstream, ofstream
+#include <iomanip>   // setw, setprecision
+#ifdef __GLIBC__
+#include <malloc.h>  // mallinfo, mallinfo2
+#endif
+#include <random>    // mt19937_64
+#include <regex>     // regex, regex_search
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Free text rows built from a small vocabulary, plus a rare marker word.
+static void make_text_table(size_t rows, header_t& header, table_t& table)
+{
+    static const char* words[] = {
+        "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+        "india", "juliet", "kilo", "lima", "mike", "november", "oscar", "papa"
+    };
+    std::mt19937_64 rng(42);
+
+    header = header_t {{"id", 0}, {"text", 1}};
+    table.clear();
+    table.reserve(rows);
+    for (size_t i = 0; i < rows; i++)
+    {
+        std::string text;
+        size_t n = 3 + rng() % 4;
+        for (size_t j = 0; j < n; j++)
+        {
+            if (j) text += ' ';
+            text += words[rng() % 16];
+        }
+        if (rng() % 1000 == 0)
+        {
+            text += " zebra";
+        }
+        table.push_back(row_t {std::to_string(i), text});
+    }
+}
+
+// LIKE '%substring%' with and without a trigram index.
+static void bench_trigram(size_t rows)
+{
+    header_t header;
+    table_t table;
+    make_text_table(rows, header, table);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    TrigramIndex index(header, table, "text");
+    std::cout << "rows: " << rows << ", trigram index build: " << seconds_since(start) << " s\n";
+
+    const char* patterns[] = {"%zebra%", "%ta go%", "%echo%"};
+    for (size_t p = 0; p < 3; p++)
+    {
+        Where where;
+        where.AddCondition(new Condition<std::string>("text", Operator::LIKE, patterns[p]));
+
+        Scan brute(header, table, where);
+        start = std::chrono::steady_clock::now();
+        size_t expected = brute.run().size();
+        double brute_s = seconds_since(start);
+
+        Scan indexed(header, table, where);
+        indexed.AddIndex(&index);
+        start = std::chrono::steady_clock::now();
+        size_t found = indexed.run().size();
+        double indexed_s = seconds_since(start);
+
+        std::cout << patterns[p] << ": " << found << " rows"
+                  << (found == expected ? "" : " (MISMATCH)")
+                  << ", brute force " << brute_s << " s"
+                  << ", trigram " << indexed_s << " s"
+                  << ", speedup " << brute_s / indexed_s << "x\n";
+    }
+}
+
+// RegexMatcher against known results, MySQL REGEXP semantics. Returns the number of failures.
+static size_t check_regexp()
+{
+    struct Case
+    {
+        const char* pattern;
+        const char* text;
+        int expected; // 1 match, 0 no match, -1 rejected pattern
+    };
+    static const Case cases[] = {
+        {"abc",      "xxabcxx", 1}, {"abc",      "abx",   0},
+        {"^abc$",    "abc",     1}, {"^abc$",    "abcd",  0}, {"^abc$",  "xabc",  0},
+        {"^a|b",     "xb",      1}, {"^a|b",     "ax",    1}, {"^a|b",   "xa",    0},
+        {"a|b$",     "abc",     1}, {"a|b$",     "xb",    1}, {"a|b$",   "bx",    0},
+        {"a|^b|c$",  "bxx",     1}, {"a|^b|c$",  "xxc",   1}, {"a|^b|c$", "xbx",  0},
+        {"^(a|b)c",  "bc",      1}, {"^(a|b)c",  "xbc",   0},
+        {"(ab)+$",   "xabab",   1}, {"(ab)+$",   "ababx", 0},
+        {"a.c",      "abc",     1}, {"a.c",      "ac",    0},
+        {"colou?r",  "color",   1}, {"colou?r",  "colour", 1},
+        {"ab+c",     "ac",      0}, {"ab+c",     "abbc",  1}, {"ab*c",   "ac",    1},
+        {"[a-c]x",   "bx",      1}, {"[^a-c]x",  "bx",    0}, {"[^a-c]x", "dx",   1},
+        {"\\d+",     "a1",      1}, {"\\d+",     "ab",    0}, {"\\w\\s\\w", "a b", 1},
+        {"x\\$",     "x$",      1}, {"x\\$",     "x",     0},
+        {"a^b",      "",       -1}, {"(a$)",     "",     -1}, {"(a",     "",     -1},
+        {"a)",       "",       -1}, {"*a",       "",     -1}, {"[a",     "",     -1}
+    };
+
+    size_t failures = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+        int got;
+        try
+        {
+            RegexMatcher re(cases[i].pattern);
+            got = re.match(cases[i].text) ? 1 : 0;
+        }
+        catch (const std::invalid_argument&)
+        {
+            got = -1;
+        }
+        if (got != cases[i].expected)
+        {
+            std::cout << "REGEXP check failed: '" << cases[i].text << "' REGEXP '" << cases[i].pattern
+                      << "' gave " << got << ", expected " << cases[i].expected << "\n";
+            failures++;
+        }
+    }
+    std::cout << "known results: " << sizeof(cases) / sizeof(cases[0]) - failures << " of "
+              << sizeof(cases) / sizeof(cases[0]) << " correct\n";
+    return failures;
+}
+
+// REGEXP throughput per pattern class, with std::regex on a slice of the rows for reference.
+static void bench_regexp(size_t rows)
+{
+    check_regexp();
+
+    header_t header;
+    table_t table;
+    make_text_table(rows, header, table);
+
+    double mb = 0;
+    for (size_t i = 0; i < table.size(); i++)
+    {
+        mb += table[i][1].size();
+    }
+    mb /= 1e6;
+
+    const char* classes[][2] = {
+        {"literal",     "zebra"},
+        {"alternation", "zebra|yankee|hotel"},
+        {"class",       "[a-c][h-k]+a "},
+        {"anchored",    "^echo.*golf$"},
+        {"wildcards",   "l.*m.*n.*zebra"}
+    };
+    size_t slice = rows / 100 ? rows / 100 : rows;
+    for (size_t p = 0; p < 5; p++)
+    {
+        Where where;
+        where.AddCondition(new Condition<std::string>("text", Operator::REGEXP, classes[p][1]));
+        Scan scan(header, table, where);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t found = scan.run().size();
+        double dfa_s = seconds_since(start);
+
+        std::regex re(classes[p][1]);
+        double slice_mb = 0;
+        start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < slice; i++)
+        {
+            std::regex_search(table[i][1], re);
+            slice_mb += table[i][1].size();
+        }
+        double std_s = seconds_since(start);
+
+        std::cout << classes[p][0] << " \"" << classes[p][1] << "\": " << found << " rows, "
+                  << "lazy DFA " << mb / dfa_s << " MB/s, "
+                  << "std::regex " << slice_mb / 1e6 / std_s << " MB/s\n";
+    }
+}
+
+// People rows shaped like the demo table in where.cpp.
+static void make_people_table(size_t rows, header_t& header, table_t& table)
+{
+    std::mt19937_64 rng(7);
+
+    header = header_t {{"name", 0}, {"age", 1}, {"gender", 2}, {"score", 3}, {"company", 4}};
+    table.clear();
+    table.reserve(rows);
+    for (size_t i = 0; i < rows; i++)
+    {
+        table.push_back(row_t {
+            "person" + std::to_string(rng() % 1000000),
+            std::to_string(18 + rng() % 60),
+            rng() % 2 ? "male" : "female",
+            std::to_string(rng() % 200),
+            "company" + std::to_string(rng() % 1000)
+        });
+    }
+}
+
+static ConditionBase* share(ConditionRegistry* registry, ConditionBase* c)
+{
+    return registry ? registry->Share(c) : c;
+}
+
+// Add a condition of type C to w: built in place when the clause lives in an arena,
+// otherwise on the heap, shared through the registry if there is one.
+template <typename C, typename... Args>
+static Where* add_condition(Where* w, ConditionRegistry* registry, Arena* arena, Args&&... args)
+{
+    if (arena)
+    {
+        return w->Emplace<C>(std::forward<Args>(args)...);
+    }
+    return w->AddCondition(share(registry, new C(std::forward<Args>(args)...)));
+}
+
+// Subscription style clauses: mostly equality on company / name, plus thresholds and OR groups.
+// With a registry, identical conditions across clauses are shared. With an arena, the clause
+// is built in place in it together with its conditions.
+static Where* make_subscription(size_t i, std::mt19937_64& rng, ConditionRegistry* registry = NULL, Arena* arena = NULL)
+{
+    Where* w = arena ? arena->Create<Where>(arena) : new Where();
+    std::string company = "company" + std::to_string(rng() % 1000);
+    std::string other   = "company" + std::to_string(rng() % 1000);
+    std::string name    = "person" + std::to_string(rng() % 1000000);
+    std::string gender  = rng() % 2 ? "male" : "female";
+    int age             = (int)(18 + rng() % 60);
+    float score         = (float)(rng() % 200);
+
+    switch (i % 5)
+    {
+        case 0:
+            add_condition<Condition<std::string> >(w, registry, arena, "company", Operator::EQ, company)->AddOperator(Operator::AND);
+            add_condition<Condition<int> >(w, registry, arena, "age", Operator::GT, age);
+            break;
+        case 1:
+            add_condition<Condition<std::string> >(w, registry, arena, "gender", Operator::EQ, gender)->AddOperator(Operator::AND);
+            add_condition<InCondition<std::string> >(w, registry, arena, "company", std::vector<std::string> {company, other});
+            break;
+        case 2:
+            add_condition<Condition<std::string> >(w, registry, arena, "name", Operator::EQ, name)->AddOperator(Operator::OR);
+            add_condition<Condition<std::string> >(w, registry, arena, "company", Operator::EQ, company)->AddOperator(Operator::AND);
+            add_condition<Condition<float> >(w, registry, arena, "score", Operator::GE, score);
+            break;
+        case 3:
+            add_condition<Condition<int> >(w, registry, arena, "age", Operator::GE, age)->AddOperator(Operator::AND);
+            add_condition<Condition<int> >(w, registry, arena, "age", Operator::LT, age + 5)->AddOperator(Operator::AND);
+            add_condition<Condition<float> >(w, registry, arena, "score", Operator::GT, score);
+            break;
+        default:
+            add_condition<Condition<int> >(w, registry, arena, "age", Operator::EQ, age)->AddOperator(Operator::AND);
+            add_condition<Condition<std::string> >(w, registry, arena, "company", Operator::EQ, company);
+            break;
+    }
+    return w;
+}
+
+// Many registered clauses per row: MatchEngine and shared conditions against one
+// Where::eval per clause.
+static void bench_match(size_t rows)
+{
+    header_t header;
+    table_t table;
+    make_people_table(rows, header, table);
+
+    const size_t clauses = 50000;
+    MatchEngine engine;
+    ConditionRegistry registry;
+    std::vector<Where*> plain, shared;
+    std::mt19937_64 rng_engine(11), rng_plain(11), rng_shared(11);
+    for (size_t i = 0; i < clauses; i++)
+    {
+        engine.AddClause(make_subscription(i, rng_engine));
+        plain.push_back(make_subscription(i, rng_plain));
+        shared.push_back(make_subscription(i, rng_shared, &registry));
+    }
+
+    size_t expected = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < table.size(); r++)
+    {
+        for (size_t i = 0; i < plain.size(); i++)
+        {
+            expected += plain[i]->eval(header, table[r]);
+        }
+    }
+    double loop_s = seconds_since(start);
+
+    size_t shared_found = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < table.size(); r++)
+    {
+        registry.BeginRow();
+        for (size_t i = 0; i < shared.size(); i++)
+        {
+            shared_found += shared[i]->eval(header, table[r]);
+        }
+    }
+    double shared_s = seconds_since(start);
+
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < table.size(); r++)
+    {
+        found += engine.match(header, table[r]).size();
+    }
+    double engine_s = seconds_since(start);
+
+    std::cout << "rows: " << rows << ", clauses: " << clauses << ", matches: " << found
+              << (found == expected && shared_found == expected ? "" : " (MISMATCH)") << "\n"
+              << "Where::eval loop " << loop_s / rows * 1e6 << " us/row\n"
+              << "shared conditions " << shared_s / rows * 1e6 << " us/row, "
+              << registry.size() << " distinct conditions, "
+              << (double)registry.evaluated() / rows << " evaluations/row\n"
+              << "MatchEngine " << engine_s / rows * 1e6 << " us/row, "
+              << "speedup " << loop_s / engine_s << "x\n";
+
+    for (size_t i = 0; i < plain.size(); i++)
+    {
+        delete plain[i];
+        delete shared[i];
+    }
+}
+
+// The clause from the demo in where.cpp.
+static Where* make_demo_clause()
+{
+    Where* w = new Where();
+    w->AddCondition(new Condition<std::string>("name", Operator::NE, "Bill Gates"))
+     ->AddOperator(Operator::AND)
+     ->AddCondition(new Condition<int>("age", Operator::GT, 30))
+     ->AddOperator(Operator::OR)
+     ->AddCondition(new Condition<std::string>("gender", Operator::EQ, "female"))
+     ->AddOperator(Operator::AND)
+     ->AddCondition(new Condition<float>("score", Operator::LE, 100))
+     ->AddOperator(Operator::OR)
+     ->AddCondition(new Condition<std::string>("company", Operator::EQ, "IBX"));
+    return w;
+}
+
+// Cost of keeping a MaterializedFilter current per change, against rescanning the table.
+static void bench_incremental(size_t rows)
+{
+    header_t header;
+    table_t table;
+    make_people_table(rows, header, table);
+    std::shared_ptr<Where> where(make_demo_clause());
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Scan scan(header, table, *where);
+    size_t expected = scan.run().size();
+    double rescan_s = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    MaterializedFilter filter(header, table, *where);
+    double build_s = seconds_since(start);
+
+    const size_t changes = 100000;
+    std::mt19937_64 rng(3);
+    size_t before = filter.evaluated();
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < changes; i++)
+    {
+        switch (i % 4)
+        {
+            case 0:  filter.update(rng() % table.size(), "age", std::to_string(18 + rng() % 60)); break;
+            case 1:  filter.update(rng() % table.size(), "company", "company" + std::to_string(rng() % 1000)); break;
+            case 2:  filter.update(rng() % table.size(), "score", std::to_string(rng() % 200)); break;
+            default: filter.insert(row_t {"new", "40", "female", "99", "IBX"}); break;
+        }
+    }
+    double change_s = seconds_since(start);
+    size_t change_evals = filter.evaluated() - before;
+
+    Scan check(header, table, *where);
+    bool consistent = check.run().size() == filter.count();
+
+    std::cout << "rows: " << rows << ", matches: " << expected << " before, "
+              << filter.count() << " after " << changes << " changes"
+              << (consistent ? "" : " (MISMATCH)") << "\n"
+              << "full rescan " << rescan_s * 1e3 << " ms, materialize " << build_s * 1e3 << " ms\n"
+              << "per change: " << change_s / changes * 1e6 << " us, "
+              << (double)change_evals / changes << " condition evaluations"
+              << " (a rescan evaluates up to " << rows * 5 << ")\n";
+}
+
+// Repeated dashboard queries: a cold scan against cache hits on an unchanged table.
+static void bench_cache(size_t rows)
+{
+    header_t header;
+    table_t table;
+    make_people_table(rows, header, table);
+
+    Where where;
+    where.AddCondition(new Condition<std::string>("company", Operator::EQ, "company42"))
+         ->AddOperator(Operator::AND)
+         ->AddCondition(new Condition<int>("age", Operator::GT, 30));
+
+    ResultCache cache(16 << 20);
+    Scan scan(header, table, where);
+    scan.SetCache(&cache, 1);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t expected = scan.run().size();
+    double miss_s = seconds_since(start);
+
+    const size_t repeats = 10000;
+    bool consistent = true;
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < repeats; i++)
+    {
+        consistent &= scan.run().size() == expected;
+    }
+    double hit_s = seconds_since(start) / repeats;
+
+    std::cout << "rows: " << rows << ", matches: " << expected << (consistent ? "" : " (MISMATCH)") << "\n"
+              << "miss (scan) " << miss_s * 1e3 << " ms, hit " << hit_s * 1e6 << " us, "
+              << cache.byteSize() << " bytes cached, " << cache.hitCount() << " hits\n";
+}
+
+// COUNT(*) against materializing the matching row ids, with and without a Validity index.
+static void bench_count(size_t rows)
+{
+    header_t header;
+    table_t table;
+    make_people_table(rows, header, table);
+    for (size_t i = 0; i < table.size(); i += 10)
+    {
+        table[i][3] = ""; // 10% of the scores are NULL
+    }
+    Validity validity(header, table);
+
+    std::shared_ptr<Where> demo(make_demo_clause());
+    Where nulls;
+    nulls.AddCondition(new Condition<float>("score", Operator::IS_NULL));
+
+    Where* clauses[] = {demo.get(), &nulls};
+    const char* names[] = {"demo clause", "score IS NULL"};
+    for (size_t c = 0; c < 2; c++)
+    {
+        Scan scan(header, table, *clauses[c]);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t expected = scan.run().size();
+        double run_s = seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        size_t counted = scan.count();
+        double count_s = seconds_since(start);
+
+        Scan indexed(header, table, *clauses[c]);
+        indexed.AddIndex(&validity);
+        start = std::chrono::steady_clock::now();
+        size_t indexed_counted = indexed.count();
+        double indexed_s = seconds_since(start);
+
+        std::cout << names[c] << ": " << counted
+                  << (counted == expected && indexed_counted == expected ? "" : " (MISMATCH)")
+                  << ", run() " << run_s * 1e3 << " ms, count() " << count_s * 1e3 << " ms"
+                  << ", count() with validity bitmaps " << indexed_s * 1e3 << " ms\n";
+    }
+}
+
+// Startup cost: reparsing a tab separated text file against mapping a column file,
+// then the demo clause over each.
+static void bench_columnar(size_t rows)
+{
+    header_t header;
+    table_t table;
+    make_people_table(rows, header, table);
+    {
+        std::ofstream text("bench.tsv", std::ios::binary);
+        for (size_t r = 0; r < table.size(); r++)
+        {
+            for (size_t c = 0; c < table[r].size(); c++)
+            {
+                text << (c ? "\t" : "") << table[r][c];
+            }
+            text << '\n';
+        }
+    }
+    ColumnFile::Write("bench.col", header, table);
+    table.clear();
+    table.shrink_to_fit();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::ifstream text("bench.tsv", std::ios::binary);
+    std::string line;
+    while (std::getline(text, line))
+    {
+        row_t row;
+        size_t begin = 0;
+        for (size_t tab = line.find('\t'); tab != std::string::npos; tab = line.find('\t', begin))
+        {
+            row.push_back(line.substr(begin, tab - begin));
+            begin = tab + 1;
+        }
+        row.push_back(line.substr(begin));
+        table.push_back(row);
+    }
+    double text_s = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    ColumnFile file("bench.col");
+    double map_s = seconds_since(start);
+
+    std::shared_ptr<Where> where(make_demo_clause());
+    Scan scan(header, table, *where);
+    start = std::chrono::steady_clock::now();
+    size_t expected = scan.count();
+    double scan_s = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    size_t found = where->select(file).count();
+    double columnar_s = seconds_since(start);
+
+    std::cout << "rows: " << rows << ", load text " << text_s * 1e3 << " ms"
+              << ", map column file " << map_s * 1e3 << " ms\n"
+              << "demo clause: " << found << " rows" << (found == expected ? "" : " (MISMATCH)")
+              << ", rows " << scan_s * 1e3 << " ms, columns " << columnar_s * 1e3 << " ms\n";
+
+    // age is bit packed in the file: compared on packed words against decoding row by row.
+    Where ages;
+    ages.AddCondition(new BetweenCondition<int>("age", 30, 40));
+    start = std::chrono::steady_clock::now();
+    size_t packed = ages.select(file).count();
+    double packed_s = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    size_t decoded = 0;
+    for (size_t r = 0; r < file.rows(); r++)
+    {
+        decoded += ages.eval3(file, r) == Logic::TRUE;
+    }
+    double decoded_s = seconds_since(start);
+
+    std::cout << "age BETWEEN 30 AND 40: " << packed << " rows" << (packed == decoded ? "" : " (MISMATCH)")
+              << ", packed words " << packed_s * 1e3 << " ms, row by row " << decoded_s * 1e3 << " ms\n";
+
+    // Sorted by company, the company column is run length encoded: once per run against per row.
+    std::sort(table.begin(), table.end(), [](const row_t& a, const row_t& b) { return a[4] < b[4]; });
+    ColumnFile::Write("bench_sorted.col", header, table);
+    ColumnFile sorted("bench_sorted.col");
+    const char* patterns[] = {"company42", "%42%"};
+    for (size_t p = 0; p < 2; p++)
+    {
+        Where company;
+        company.AddCondition(new Condition<std::string>("company", p ? Operator::LIKE : Operator::EQ, patterns[p]));
+        start = std::chrono::steady_clock::now();
+        size_t runs = company.select(sorted).count();
+        double runs_s = seconds_since(start);
+
+        start = std::chrono::steady_clock::now();
+        size_t each = 0;
+        for (size_t r = 0; r < sorted.rows(); r++)
+        {
+            each += company.eval3(sorted, r) == Logic::TRUE;
+        }
+        double each_s = seconds_since(start);
+
+        std::cout << company.toString() << ": " << runs << " rows" << (runs == each ? "" : " (MISMATCH)")
+                  << ", once per run " << runs_s * 1e3 << " ms, row by row " << each_s * 1e3 << " ms\n";
+    }
+
+    std::remove("bench.tsv");
+    std::remove("bench.col");
+    std::remove("bench_sorted.col");
+}
+
+// Row group pushdown on a table clustered by company: groups ruled out by Bloom filters
+// and min / max are never read, nor are the chunks of columns the query does not use.
+static void bench_rowgroup(size_t rows)
+{
+    header_t header;
+    table_t table;
+    make_people_table(rows, header, table);
+    std::sort(table.begin(), table.end(), [](const row_t& a, const row_t& b) { return a[4] < b[4]; });
+    RowGroupFile::Write("bench.rgf", header, table);
+    std::ifstream file("bench.rgf", std::ios::binary | std::ios::ate);
+    double file_mb = (double)file.tellg() / 1e6;
+
+    const char* companies[] = {"company42", "company999"};
+    for (size_t q = 0; q < 2; q++)
+    {
+        Where where;
+        where.AddCondition(new Condition<std::string>("company", Operator::EQ, companies[q]))
+             ->AddOperator(Operator::AND)
+             ->AddCondition(new Condition<int>("age", Operator::GT, 30));
+
+        Scan scan(header, table, where);
+        scan.AddColumn("name");
+        size_t expected = scan.select().size();
+
+        RowGroupFile reader("bench.rgf");
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        size_t found = reader.select(where, std::vector<std::string>(1, "name")).size();
+        double select_s = seconds_since(start);
+
+        std::cout << "SELECT name WHERE " << where.toString() << ": " << found << " rows"
+                  << (found == expected ? "" : " (MISMATCH)") << ", " << select_s * 1e3 << " ms, "
+                  << reader.groupsRead() << " of " << reader.groupCount() << " row groups read, "
+                  << reader.bytesRead() / 1e6 << " of " << file_mb << " MB\n";
+    }
+
+    std::remove("bench.rgf");
+}
+
+// Evict a file from the page cache, so the next read comes from the disk.
+static void drop_cache(const char* path)
+{
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0)
+    {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#endif
+}
+
+// Scan throughput from a cold cache: a plain sequential read of the whole file, against
+// a select that reads every chunk, with reads on demand and with read ahead.
+static void bench_io(size_t rows)
+{
+    header_t header;
+    table_t table;
+    make_people_table(rows, header, table);
+    RowGroupFile::Write("bench.rgf", header, table);
+    table.clear();
+    table.shrink_to_fit();
+
+    drop_cache("bench.rgf");
+    std::vector<char> buffer(1 << 20);
+    std::ifstream file("bench.rgf", std::ios::binary);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double bytes = 0;
+    while (file.read(buffer.data(), buffer.size()) || file.gcount())
+    {
+        bytes += file.gcount();
+    }
+    double read_s = seconds_since(start);
+    std::cout << "rows: " << rows << ", sequential read " << bytes / 1e9 / read_s << " GB/s ("
+              << bytes / 1e6 << " MB in " << read_s * 1e3 << " ms)\n";
+
+    // Not selective and not prunable: every chunk of every group is read and evaluated.
+    size_t prefetch[] = {0, 2};
+    for (size_t p = 0; p < 2; p++)
+    {
+        Where where;
+        where.AddCondition(new Condition<std::string>("name", Operator::LIKE, "%99999%"));
+
+        drop_cache("bench.rgf");
+        RowGroupFile reader("bench.rgf");
+        reader.SetPrefetch(prefetch[p]);
+        start = std::chrono::steady_clock::now();
+        size_t found = reader.select(where).size();
+        double select_s = seconds_since(start);
+
+        std::cout << "select, prefetch " << prefetch[p] << ": " << found << " rows, "
+                  << reader.bytesRead() / 1e9 / select_s << " GB/s (" << select_s * 1e3 << " ms)\n";
+    }
+
+    std::remove("bench.rgf");
+}
+
+// Pulling matches from streams: the first few arrive without scanning the whole source,
+// and a CSV file is filtered record by record without being loaded.
+static void bench_stream(size_t rows)
+{
+    header_t header;
+    table_t table;
+    make_people_table(rows, header, table);
+    std::shared_ptr<Where> where(make_demo_clause());
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Scan scan(header, table, *where);
+    size_t expected = scan.run().size();
+    double run_s = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    TableStream first(header, table, *where);
+    for (size_t i = 0; i < 10 && first.next(); i++)
+    {
+    }
+    double first_s = seconds_since(start);
+
+    {
+        std::ofstream csv("bench.csv", std::ios::binary);
+        csv << "name,age,gender,score,company\n";
+        for (size_t r = 0; r < table.size(); r++)
+        {
+            csv << table[r][0] << ',' << table[r][1] << ',' << table[r][2] << ','
+                << table[r][3] << ',' << table[r][4] << '\n';
+        }
+    }
+    std::ifstream in("bench.csv", std::ios::binary);
+    start = std::chrono::steady_clock::now();
+    CsvStream csv(in, *where);
+    size_t found = 0;
+    while (csv.next())
+    {
+        found++;
+    }
+    double csv_s = seconds_since(start);
+
+    std::cout << "rows: " << rows << ", matches: " << expected << "\n"
+              << "Scan::run() " << run_s * 1e3 << " ms, first 10 from TableStream " << first_s * 1e6 << " us\n"
+              << "CsvStream: " << found << " rows" << (found == expected ? "" : " (MISMATCH)") << ", "
+              << rows / csv_s / 1e6 << " M rows/s\n";
+
+    std::remove("bench.csv");
+}
+
+// Bytes the allocator has handed out, headers included.
+static size_t heap_in_use()
+{
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 33)
+    return mallinfo2().uordblks;
+#else
+    return (unsigned int)mallinfo().uordblks; // an int, wraps past 4 GB
+#endif
+#else
+    return 0;
+#endif
+}
+
+// 200k subscription clauses with every condition on its own heap allocation, against
+// the same clauses packed into one arena: memory held and Where::eval over all of them.
+static void bench_arena(size_t rows)
+{
+    header_t header;
+    table_t table;
+    make_people_table(rows, header, table);
+
+    const size_t clauses = 200000;
+    std::mt19937_64 rng_heap(11), rng_arena(11);
+
+    // Other allocations made while loading are interleaved with the conditions, as they
+    // are when clauses arrive one by one.
+    std::vector<std::string*> noise;
+    size_t before = heap_in_use();
+    std::vector<Where*> heap;
+    for (size_t i = 0; i < clauses; i++)
+    {
+        heap.push_back(make_subscription(i, rng_heap));
+        noise.push_back(new std::string(48, 'x'));
+    }
+    size_t heap_bytes = heap_in_use() - before - clauses * (sizeof(std::string) + 64);
+
+    before = heap_in_use();
+    std::unique_ptr<Arena> arena(new Arena());
+    std::vector<Where*> pooled;
+    for (size_t i = 0; i < clauses; i++)
+    {
+        pooled.push_back(make_subscription(i, rng_arena, NULL, arena.get()));
+        noise.push_back(new std::string(48, 'x'));
+    }
+    size_t arena_bytes = heap_in_use() - before - clauses * (sizeof(std::string) + 64);
+
+    size_t expected = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < table.size(); r++)
+    {
+        for (size_t i = 0; i < heap.size(); i++)
+        {
+            expected += heap[i]->eval(header, table[r]);
+        }
+    }
+    double heap_s = seconds_since(start);
+
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < table.size(); r++)
+    {
+        for (size_t i = 0; i < pooled.size(); i++)
+        {
+            found += pooled[i]->eval(header, table[r]);
+        }
+    }
+    double arena_s = seconds_since(start);
+
+    size_t blocks = arena->blockCount();
+    for (size_t i = 0; i < heap.size(); i++)
+    {
+        delete heap[i];
+    }
+    arena.reset();
+    for (size_t i = 0; i < noise.size(); i++)
+    {
+        delete noise[i];
+    }
+
+    std::cout << "rows: " << rows << ", clauses: " << clauses << ", matches: " << found
+              << (found == expected ? "" : " (MISMATCH)") << "\n"
+              << "heap:  " << heap_bytes / clauses << " bytes/clause, "
+              << heap_s / rows * 1e3 << " ms/row\n"
+              << "arena: " << arena_bytes / clauses << " bytes/clause (" << blocks << " blocks), "
+              << arena_s / rows * 1e3 << " ms/row\n";
+}
+
+// Cost of Where::analyze() against plain eval3() on the demo clause, measuring every row
+// and one row in 100, followed by the EXPLAIN ANALYZE report of the sampled run.
+static void bench_analyze(size_t rows)
+{
+    header_t header;
+    table_t table;
+    make_people_table(rows, header, table);
+    std::unique_ptr<Where> where(make_demo_clause());
+
+    size_t expected = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < table.size(); r++)
+    {
+        expected += where->eval3(header, table[r]) == Logic::TRUE;
+    }
+    double plain_s = seconds_since(start);
+
+    Profile every;
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < table.size(); r++)
+    {
+        found += where->analyze(header, table[r], every) == Logic::TRUE;
+    }
+    double every_s = seconds_since(start);
+
+    Profile sampled(100);
+    size_t sampled_found = 0;
+    start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < table.size(); r++)
+    {
+        sampled_found += where->analyze(header, table[r], sampled) == Logic::TRUE;
+    }
+    double sampled_s = seconds_since(start);
+
+    std::cout << "rows: " << rows << ", matches: " << expected
+              << (found == expected && sampled_found == expected ? "" : " (MISMATCH)") << "\n"
+              << "eval3 " << plain_s / rows * 1e9 << " ns/row\n"
+              << "analyze, every row " << every_s / rows * 1e9 << " ns/row ("
+              << std::showpos << (every_s / plain_s - 1) * 100 << std::noshowpos << "%)\n"
+              << "analyze, 1 row in 100 " << sampled_s / rows * 1e9 << " ns/row ("
+              << std::showpos << (sampled_s / plain_s - 1) * 100 << std::noshowpos << "%)\n\n"
+              << where->explainAnalyze(sampled);
+}
+
+// Uniform columns, so a threshold picks an exact fraction of the rows:
+// name p000000..p999999, age 0..99, score 0.0..999.9, company0..company999, value 0..999999.
+static void make_matrix_table(size_t rows, header_t& header, table_t& table)
+{
+    std::mt19937_64 rng(42);
+
+    header = header_t {{"name", 0}, {"age", 1}, {"gender", 2}, {"score", 3}, {"company", 4}, {"value", 5}};
+    table.clear();
+    table.reserve(rows);
+    for (size_t i = 0; i < rows; i++)
+    {
+        char name[16], score[16];
+        std::snprintf(name, sizeof(name), "p%06u", (unsigned)(rng() % 1000000));
+        std::snprintf(score, sizeof(score), "%.1f", (rng() % 10000) / 10.0);
+        table.push_back(row_t {
+            name,
+            std::to_string(rng() % 100),
+            rng() % 2 ? "male" : "female",
+            score,
+            "company" + std::to_string(rng() % 1000),
+            std::to_string(rng() % 1000000)
+        });
+    }
+}
+
+// Clause shapes of the matrix, each tuned to match about the given fraction of the
+// rows of make_matrix_table().
+static Where* make_matrix_clause(const std::string& shape, double selectivity)
+{
+    Where* w = new Where();
+    if (shape == "int")
+    {
+        w->AddCondition(new Condition<int>("value", Operator::LT, (int)(selectivity * 1000000)));
+    }
+    else if (shape == "demo")
+    {
+        // The demo clause with its thresholds moved: each OR branch takes half the rows.
+        w->AddCondition(new Condition<std::string>("name", Operator::NE, "Bill Gates"))
+         ->AddOperator(Operator::AND)
+         ->AddCondition(new Condition<int>("value", Operator::GE, (int)((1 - selectivity / 2) * 1000000)))
+         ->AddOperator(Operator::OR)
+         ->AddCondition(new Condition<std::string>("gender", Operator::EQ, "female"))
+         ->AddOperator(Operator::AND)
+         ->AddCondition(new Condition<float>("score", Operator::LT, (float)(selectivity * 1000)))
+         ->AddOperator(Operator::OR)
+         ->AddCondition(new Condition<std::string>("company", Operator::EQ, "IBX"));
+    }
+    else if (shape == "string")
+    {
+        // Three string comparisons per row, only the name bound filters.
+        char bound[16];
+        std::snprintf(bound, sizeof(bound), "p%06u", (unsigned)(selectivity * 1000000));
+        w->AddCondition(new Condition<std::string>("gender", Operator::NE, "other"))
+         ->AddOperator(Operator::AND)
+         ->AddCondition(new Condition<std::string>("company", Operator::NE, "IBX"))
+         ->AddOperator(Operator::AND)
+         ->AddCondition(new Condition<std::string>("name", Operator::LT, bound));
+    }
+    else if (shape == "in")
+    {
+        std::vector<std::string> companies;
+        for (size_t i = 0; i < std::max<size_t>(1, (size_t)(selectivity * 1000 + 0.5)); i++)
+        {
+            companies.push_back("company" + std::to_string(i));
+        }
+        w->AddCondition(new InCondition<std::string>("company", companies));
+    }
+    else
+    {
+        // LIKE prefixes of k digits, ORed n times: p0% is 10%, p000% is 0.1%.
+        int k = 0;
+        double scale = 1;
+        while (selectivity * scale < 1 - 1e-9)
+        {
+            k++;
+            scale *= 10;
+        }
+        size_t n = std::max<size_t>(1, (size_t)(selectivity * scale + 0.5));
+        for (size_t i = 0; i < n; i++)
+        {
+            char prefix[16];
+            std::snprintf(prefix, sizeof(prefix), "p%0*u%%", k, (unsigned)i);
+            if (i) w->AddOperator(Operator::OR);
+            w->AddCondition(new Condition<std::string>("name", Operator::LIKE, prefix));
+        }
+    }
+    return w;
+}
+
+// Where::eval over the whole table for every clause shape and selectivity: one warmup
+// pass, then the median of the timed repetitions. The table and clauses are built from
+// fixed seeds, so runs are comparable across builds.
+static void bench_matrix(size_t rows, size_t repetitions)
+{
+    header_t header;
+    table_t table;
+    make_matrix_table(rows, header, table);
+
+    static const char* shapes[] = {"int", "demo", "string", "in", "like"};
+    static const double selectivities[] = {0.001, 0.01, 0.1, 0.5};
+
+    std::cout << "rows: " << rows << ", repetitions: " << repetitions << ", compiler: " << __VERSION__ << "\n"
+              << std::left << std::setw(8) << "shape" << std::right
+              << std::setw(8) << "target" << std::setw(9) << "actual" << std::setw(6) << "conds"
+              << std::setw(12) << "M rows/s" << std::setw(10) << "ns/row" << std::setw(10) << "ns/cond"
+              << std::setw(10) << "min ns" << "\n";
+
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+    {
+        for (size_t k = 0; k < sizeof(selectivities) / sizeof(selectivities[0]); k++)
+        {
+            std::unique_ptr<Where> where(make_matrix_clause(shapes[s], selectivities[k]));
+            std::vector<std::vector<ConditionBase*> > groups = where->groups();
+            size_t conditions = 0;
+            for (size_t g = 0; g < groups.size(); g++)
+            {
+                conditions += groups[g].size();
+            }
+
+            size_t expected = 0;
+            for (size_t r = 0; r < table.size(); r++)
+            {
+                expected += where->eval(header, table[r]);
+            }
+
+            bool consistent = true;
+            std::vector<double> times;
+            for (size_t rep = 0; rep < repetitions; rep++)
+            {
+                size_t found = 0;
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                for (size_t r = 0; r < table.size(); r++)
+                {
+                    found += where->eval(header, table[r]);
+                }
+                times.push_back(seconds_since(start));
+                consistent &= found == expected;
+            }
+            std::sort(times.begin(), times.end());
+            double median = times[times.size() / 2];
+            double ns_row = median / rows * 1e9;
+
+            std::cout << std::fixed << std::left << std::setw(8) << shapes[s] << std::right
+                      << std::setprecision(3) << std::setw(8) << selectivities[k]
+                      << std::setprecision(4) << std::setw(9) << (double)expected / rows
+                      << std::setw(6) << conditions
+                      << std::setprecision(2) << std::setw(12) << rows / median / 1e6
+                      << std::setprecision(1) << std::setw(10) << ns_row
+                      << std::setw(10) << ns_row / conditions
+                      << std::setw(10) << times[0] / rows * 1e9
+                      << (consistent ? "" : " (MISMATCH)") << "\n";
+        }
+    }
+    std::cout.unsetf(std::ios::floatfield);
+    std::cout.precision(6);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string name = argc > 1 ? argv[1] : "trigram";
+    // Modes that evaluate tens of thousands of clauses per row default to a few rows.
+    size_t rows = 10000000;
+    if (name == "match")
+    {
+        rows = 2000;
+    }
+    else if (name == "arena")
+    {
+        rows = 100;
+    }
+    size_t repetitions = 5; // matrix only
+    if (argc > 2)
+    {
+        rows = (size_t)std::max(std::atol(argv[2]), 0L);
+    }
+    if (argc > 3)
+    {
+        repetitions = (size_t)std::max(std::atol(argv[3]), 0L);
+    }
+    if (rows == 0 || repetitions == 0)
+    {
+        std::cout << "usage: ./bench <benchmark> [rows] [repetitions], both at least 1" << std::endl;
+        return 1;
+    }
+
+    if (name == "trigram")
+    {
+        bench_trigram(rows);
+    }
+    else if (name == "regexp")
+    {
+        bench_regexp(rows);
+    }
+    else if (name == "match")
+    {
+        bench_match(rows);
+    }
+    else if (name == "incremental")
+    {
+        bench_incremental(rows);
+    }
+    else if (name == "cache")
+    {
+        bench_cache(rows);
+    }
+    else if (name == "count")
+    {
+        bench_count(rows);
+    }
+    else if (name == "columnar")
+    {
+        bench_columnar(rows);
+    }
+    else if (name == "rowgroup")
+    {
+        bench_rowgroup(rows);
+    }
+    else if (name == "io")
+    {
+        bench_io(rows);
+    }
+    else if (name == "stream")
+    {
+        bench_stream(rows);
+    }
+    else if (name == "arena")
+    {
+        bench_arena(rows);
+    }
+    else if (name == "analyze")
+    {
+        bench_analyze(rows);
+    }
+    else if (name == "matrix")
+    {
+        bench_matrix(rows, repetitions);
+    }
+    else
+    {
+        std::cout << "unknown benchmark: " << name << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
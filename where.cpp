@@ -1,14 +1,45 @@
-#include <iostream>  // cout
-#include <map>       // map
-#include <memory>    // shared_ptr
-#include <stdexcept> // stoi, stod
-#include <string>    // string, stoi, stod
-#include <vector>    // vector
+#include <algorithm>     // binary_search, sort, unique
+#include <atomic>        // atomic
+#include <chrono>        // steady_clock
+#include <climits>       // INT_MAX, INT_MIN
+#include <cerrno>        // errno, ERANGE
+#include <cmath>         // ceil, log, nextafter
+#include <condition_variable> // condition_variable
+#include <cstdint>       // int32_t, uint32_t, uint64_t
+#include <cstdio>        // snprintf
+#include <cstdlib>       // strtol, strtod
+#include <cstring>       // memcmp, memcpy
+#include <exception>     // exception_ptr, rethrow_exception
+#include <fstream>       // ifstream, ofstream
+#include <iomanip>       // setprecision
+#include <iostream>      // cout
+#include <list>          // list
+#include <map>           // map
+#include <memory>        // shared_ptr, unique_ptr
+#include <mutex>         // mutex, lock_guard
+#include <new>           // placement new
+#include <sstream>       // ostringstream
+#include <stdexcept>     // invalid_argument, out_of_range, runtime_error
+#include <string>        // string
+#include <thread>        // thread
+#include <typeinfo>      // typeid
+#include <unordered_map> // unordered_map
+#include <unordered_set> // unordered_set
+#include <utility>       // forward
+#include <vector>        // vector
+
+#ifndef _WIN32
+#include <fcntl.h>       // open
+#include <sys/mman.h>    // mmap, munmap
+#include <sys/stat.h>    // fstat
+#include <unistd.h>      // close
+#endif
 
 typedef std::map<std::string, int> header_t;
 typedef std::vector<std::string>      row_t;
 typedef std::vector<row_t>          table_t;
 typedef int                      operator_t;
+typedef int                         logic_t;
 
 class Operator
 {
@@ -21,198 +52,5692 @@ public:
     static const operator_t GE  = 0x05;
     static const operator_t AND = 0x07;
     static const operator_t OR  = 0x08;
+    static const operator_t LIKE = 0x09;
+    static const operator_t IN   = 0x0A;
+    static const operator_t BETWEEN = 0x0B;
+    static const operator_t ILIKE   = 0x0C;
+    static const operator_t REGEXP  = 0x0D;
+    static const operator_t IS_NULL     = 0x0E;
+    static const operator_t IS_NOT_NULL = 0x0F;
 
     static const std::string toString(operator_t op)
     {
-        static const std::string ops[8] = {"=", "!=", "<", "<=", ">", ">=", "AND", "OR"};
+        static const std::string ops[16] = {"=", "!=", "<", "<=", ">", ">=", "", "AND", "OR",
+                                            "LIKE", "IN", "BETWEEN", "ILIKE", "REGEXP",
+                                            "IS NULL", "IS NOT NULL"};
 
         return ops[op];
     }
-};
+};
+
+// Definitions, so the constants can be bound to references, i.e. forwarded by Where::Emplace().
+const operator_t Operator::EQ;
+const operator_t Operator::NE;
+const operator_t Operator::LT;
+const operator_t Operator::LE;
+const operator_t Operator::GT;
+const operator_t Operator::GE;
+const operator_t Operator::AND;
+const operator_t Operator::OR;
+const operator_t Operator::LIKE;
+const operator_t Operator::IN;
+const operator_t Operator::BETWEEN;
+const operator_t Operator::ILIKE;
+const operator_t Operator::REGEXP;
+const operator_t Operator::IS_NULL;
+const operator_t Operator::IS_NOT_NULL;
+
+// SQL three-valued logic. A comparison with a NULL (empty) cell is UNKNOWN, and a row only
+// passes the clause when it evaluates to TRUE.
+class Logic
+{
+public:
+    static const logic_t FALSE   = 0;
+    static const logic_t TRUE    = 1;
+    static const logic_t UNKNOWN = 2;
+
+    static logic_t And(logic_t a, logic_t b)
+    {
+        if (a == FALSE || b == FALSE) return FALSE;
+        return (a == TRUE && b == TRUE) ? TRUE : UNKNOWN;
+    }
+
+    static logic_t Or(logic_t a, logic_t b)
+    {
+        if (a == TRUE || b == TRUE) return TRUE;
+        return (a == FALSE && b == FALSE) ? FALSE : UNKNOWN;
+    }
+
+    static const std::string toString(logic_t v)
+    {
+        static const std::string values[3] = {"FALSE", "TRUE", "UNKNOWN"};
+
+        return values[v];
+    }
+};
+
+// Count set bits / trailing zeros of a 64-bit word.
+inline int popcount64(uint64_t x)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    int n = 0;
+    for (; x; x &= x - 1) n++;
+    return n;
+#endif
+}
+
+inline int ctz64(uint64_t x)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    for (; !(x & 1); x >>= 1) n++;
+    return n;
+#endif
+}
+
+// 64-bit FNV-1a followed by a splitmix finalizer, so every bit of the result is usable.
+inline uint64_t hashString(const std::string& s)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27; h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+// One bit per row, used to pass candidate row sets between indexes and the scan.
+class Bitmap
+{
+private:
+    std::vector<uint64_t> words;
+    size_t bits;
+
+    // Binary operations only make sense between bitmaps of the same rows.
+    void checkSize(const Bitmap& other) const
+    {
+        if (other.bits != bits)
+        {
+            throw std::invalid_argument("bitmaps of " + std::to_string(bits) + " and " +
+                                        std::to_string(other.bits) + " rows");
+        }
+    }
+
+public:
+    Bitmap(size_t size = 0, bool value = false)
+    {
+        bits = size;
+        words.assign((size + 63) / 64, 0);
+        if (value)
+        {
+            fill(true);
+        }
+    }
+
+    size_t size() const { return bits; }
+
+    void set(size_t i)        { words[i >> 6] |=  (1ULL << (i & 63)); }
+    void reset(size_t i)      { words[i >> 6] &= ~(1ULL << (i & 63)); }
+    bool test(size_t i) const { return (words[i >> 6] >> (i & 63)) & 1; }
+
+    // Set bits [begin, end).
+    void setRange(size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end && i < bits; i++)
+        {
+            set(i);
+        }
+    }
+
+    // Set the bits of [begin, end) that are set in other, a word at a time.
+    void orRange(const Bitmap& other, size_t begin, size_t end)
+    {
+        checkSize(other);
+        end = std::min(end, bits);
+        if (begin >= end)
+        {
+            return;
+        }
+        size_t first = begin >> 6;
+        size_t last  = (end - 1) >> 6;
+        for (size_t w = first; w <= last; w++)
+        {
+            uint64_t mask = ~0ULL;
+            if (w == first) mask &= ~0ULL << (begin & 63);
+            if (w == last)  mask &= ~0ULL >> (63 - ((end - 1) & 63));
+            words[w] |= other.words[w] & mask;
+        }
+    }
+
+    void fill(bool value)
+    {
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            words[i] = value ? ~0ULL : 0;
+        }
+        // Keep the bits past the end clear, so count() stays honest.
+        if (value && (bits & 63))
+        {
+            words.back() = (1ULL << (bits & 63)) - 1;
+        }
+    }
+
+    Bitmap& operator&=(const Bitmap& other)
+    {
+        checkSize(other);
+        for (size_t i = 0; i < words.size(); i++) words[i] &= other.words[i];
+        return *this;
+    }
+
+    Bitmap& operator|=(const Bitmap& other)
+    {
+        checkSize(other);
+        for (size_t i = 0; i < words.size(); i++) words[i] |= other.words[i];
+        return *this;
+    }
+
+    // Clear the bits set in other.
+    Bitmap& subtract(const Bitmap& other)
+    {
+        checkSize(other);
+        for (size_t i = 0; i < words.size(); i++) words[i] &= ~other.words[i];
+        return *this;
+    }
+
+    void flip()
+    {
+        for (size_t i = 0; i < words.size(); i++) words[i] = ~words[i];
+        if (bits & 63)
+        {
+            words.back() &= (1ULL << (bits & 63)) - 1;
+        }
+    }
+
+    // Raw word i, holding bits [64 * i, 64 * i + 64).
+    uint64_t word(size_t i) const        { return words[i]; }
+    void setWord(size_t i, uint64_t w)   { words[i] = w; }
+
+    size_t count() const
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < words.size(); i++) n += popcount64(words[i]);
+        return n;
+    }
+
+    // Index of the first set bit at or after i, or size() if there is none.
+    size_t next(size_t i) const
+    {
+        if (i >= bits) return bits;
+
+        size_t w = i >> 6;
+        uint64_t word = words[w] & (~0ULL << (i & 63));
+        while (!word)
+        {
+            if (++w == words.size()) return bits;
+            word = words[w];
+        }
+        return (w << 6) + ctz64(word);
+    }
+};
+
+// Compiled SQL LIKE / ILIKE pattern: '%' matches any run of characters, '_' exactly one.
+// The pattern is classified once, so the common shapes cost about one string compare:
+// 'abc' and 'abc%' / '%abc' / '%abc%' become memcmp or a memchr based search. Everything
+// else is matched segment by segment: the runs between '%' are anchored at the ends or
+// taken at their leftmost occurrence, which never needs to backtrack.
+class LikeMatcher
+{
+private:
+    static const int EXACT    = 0;
+    static const int PREFIX   = 1;
+    static const int SUFFIX   = 2;
+    static const int CONTAINS = 3;
+    static const int GENERAL  = 4;
+
+    int kind;
+    bool fold;                         // ILIKE: compare lower cased
+    std::string literal;               // EXACT, PREFIX, SUFFIX, CONTAINS
+    std::vector<std::string> segments; // GENERAL: runs between '%'
+
+    static char lower(char c)
+    {
+        return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+    }
+
+    // Does seg match s at offset at? '_' matches anything.
+    bool segmentAt(const std::string& s, size_t at, const std::string& seg) const
+    {
+        for (size_t k = 0; k < seg.size(); k++)
+        {
+            char c = fold ? lower(s[at + k]) : s[at + k];
+            if (seg[k] != '_' && seg[k] != c)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    LikeMatcher(const std::string& pattern = "", bool ignore_case = false)
+    {
+        fold = ignore_case;
+
+        std::string seg;
+        for (size_t i = 0; i < pattern.size(); i++)
+        {
+            if (pattern[i] == '%')
+            {
+                segments.push_back(seg);
+                seg.clear();
+            }
+            else
+            {
+                seg += fold ? lower(pattern[i]) : pattern[i];
+            }
+        }
+        segments.push_back(seg);
+
+        kind = GENERAL;
+        if (fold || pattern.find('_') != std::string::npos)
+        {
+            return;
+        }
+
+        size_t n = segments.size();
+        if (n == 1)
+        {
+            kind = EXACT;
+            literal = segments[0];
+        }
+        else if (n == 2 && segments[1].empty())
+        {
+            kind = PREFIX;
+            literal = segments[0];
+        }
+        else if (n == 2 && segments[0].empty())
+        {
+            kind = SUFFIX;
+            literal = segments[1];
+        }
+        else if (n == 3 && segments[0].empty() && segments[2].empty())
+        {
+            kind = CONTAINS;
+            literal = segments[1];
+        }
+    }
+
+    // How the pattern is matched, for EXPLAIN.
+    std::string describe() const
+    {
+        switch (kind)
+        {
+            case EXACT:    return "exact compare";
+            case PREFIX:   return "prefix memcmp";
+            case SUFFIX:   return "suffix memcmp";
+            case CONTAINS: return "substring search";
+            default:       return fold ? "wildcard segments, case folded" : "wildcard segments";
+        }
+    }
+
+    bool match(const std::string& s) const
+    {
+        size_t n = literal.size();
+        switch (kind)
+        {
+            case EXACT:    return s == literal;
+            case PREFIX:   return s.size() >= n && memcmp(s.data(), literal.data(), n) == 0;
+            case SUFFIX:   return s.size() >= n && memcmp(s.data() + s.size() - n, literal.data(), n) == 0;
+            case CONTAINS: return s.find(literal) != std::string::npos;
+            default:       break;
+        }
+
+        const std::string& first = segments.front();
+        const std::string& last  = segments.back();
+        if (segments.size() == 1)
+        {
+            return s.size() == first.size() && segmentAt(s, 0, first);
+        }
+        if (s.size() < first.size() + last.size() ||
+            !segmentAt(s, 0, first) || !segmentAt(s, s.size() - last.size(), last))
+        {
+            return false;
+        }
+
+        size_t pos = first.size();
+        size_t end = s.size() - last.size();
+        for (size_t i = 1; i + 1 < segments.size(); i++)
+        {
+            const std::string& seg = segments[i];
+            while (pos + seg.size() <= end && !segmentAt(s, pos, seg))
+            {
+                pos++;
+            }
+            if (pos + seg.size() > end)
+            {
+                return false;
+            }
+            pos += seg.size();
+        }
+        return true;
+    }
+};
+
+// REGEXP pattern compiled to a Thompson NFA and matched with a lazily built DFA, so every
+// input byte costs one table lookup once the states it needs exist, and matching never
+// backtracks. DFA states are cached up to a bound; when the cache fills up it is flushed
+// and rebuilt from the state the match is in.
+// Supports literals, '.', [classes], \d \w \s escapes, ( ), |, *, +, ? and ^ / $ at the start /
+// end of a top level branch, where they anchor that branch only: ^a|b matches xb.
+// Unanchored branches match anywhere in the cell, like MySQL REGEXP.
+class RegexMatcher
+{
+private:
+    struct CharSet
+    {
+        uint64_t bits[4];
+
+        CharSet()                      { bits[0] = bits[1] = bits[2] = bits[3] = 0; }
+        void set(unsigned char c)      { bits[c >> 6] |= 1ULL << (c & 63); }
+        bool test(unsigned char c) const { return (bits[c >> 6] >> (c & 63)) & 1; }
+        void setRange(unsigned char lo, unsigned char hi) { for (int c = lo; c <= hi; c++) set((unsigned char)c); }
+        void invert()                  { for (int i = 0; i < 4; i++) bits[i] = ~bits[i]; }
+        void merge(const CharSet& o)   { for (int i = 0; i < 4; i++) bits[i] |= o.bits[i]; }
+    };
+
+    static const int CHAR  = 0; // consume a byte in set, go to out
+    static const int EPS   = 1; // go to out
+    static const int SPLIT = 2; // go to out and out1
+    static const int MATCH = 3; // accept as soon as reached
+    static const int MATCH_END = 4; // accept only at the end of the cell ($)
+
+    struct NState
+    {
+        int kind;
+        CharSet set;
+        int out;
+        int out1;
+    };
+
+    struct DState
+    {
+        std::vector<int> nstates; // sorted CHAR / MATCH states
+        bool match;
+        bool match_end;
+        int next[256];            // -1 until computed
+    };
+
+    // The lazily built DFA. Every thread matching with this matcher grows its own,
+    // so parallel scans neither wait for nor see each other's half built states.
+    struct Dfa
+    {
+        std::vector<DState> dstates;
+        std::map<std::vector<int>, int> cache;
+        size_t flushes;
+        int dstart;
+
+        Dfa() : flushes(0), dstart(-1) {}
+    };
+
+    std::vector<NState> nfa;      // read only once built
+    std::vector<int> start_set;   // closure of every top level branch
+    std::vector<int> restart_set; // closure of the branches without ^, entered at every byte
+    size_t max_states;
+    uint64_t id; // names this matcher's DFA in every thread
+
+    std::string pattern;
+    size_t pos;
+    int depth; // of ( ) around pos
+
+    // DFAs of the calling thread, by matcher id. Ids are never reused, so a matcher
+    // built at the address of a destroyed one does not pick up its states.
+    static std::unordered_map<uint64_t, Dfa>& threadDfas()
+    {
+        static thread_local std::unordered_map<uint64_t, Dfa> dfas;
+        return dfas;
+    }
+
+    static uint64_t nextId()
+    {
+        static std::atomic<uint64_t> ids(0);
+        return ++ids;
+    }
+
+    int newState(int kind, int out = -1, int out1 = -1)
+    {
+        NState s;
+        s.kind = kind;
+        s.out  = out;
+        s.out1 = out1;
+        nfa.push_back(s);
+        return (int)nfa.size() - 1;
+    }
+
+    // Partially built NFA: its entry state and the exits still to be patched. Exits are
+    // state index * 2 + (0 for out, 1 for out1), pointers into nfa would dangle as it grows.
+    struct Piece
+    {
+        int start;
+        std::vector<int> outs;
+    };
+
+    void patch(const std::vector<int>& outs, int target)
+    {
+        for (size_t i = 0; i < outs.size(); i++)
+        {
+            NState& s = nfa[outs[i] >> 1];
+            (outs[i] & 1 ? s.out1 : s.out) = target;
+        }
+    }
+
+    void fail(const std::string& what)
+    {
+        throw std::invalid_argument("regexp \"" + pattern + "\": " + what);
+    }
+
+    bool more() const { return pos < pattern.size(); }
+
+    CharSet parseEscape()
+    {
+        if (!more()) fail("trailing backslash");
+
+        CharSet set;
+        char c = pattern[pos++];
+        switch (c)
+        {
+            case 'd': set.setRange('0', '9'); break;
+            case 'w': set.setRange('a', 'z'); set.setRange('A', 'Z'); set.setRange('0', '9'); set.set('_'); break;
+            case 's': set.set(' '); set.setRange('\t', '\r'); break;
+            case 'D': set.setRange('0', '9'); set.invert(); break;
+            case 'W': set.setRange('a', 'z'); set.setRange('A', 'Z'); set.setRange('0', '9'); set.set('_'); set.invert(); break;
+            case 'S': set.set(' '); set.setRange('\t', '\r'); set.invert(); break;
+            case 'n': set.set('\n'); break;
+            case 't': set.set('\t'); break;
+            default:  set.set((unsigned char)c); break;
+        }
+        return set;
+    }
+
+    CharSet parseClass()
+    {
+        CharSet set;
+        bool negate = more() && pattern[pos] == '^';
+        if (negate) pos++;
+
+        bool first = true;
+        while (more() && (pattern[pos] != ']' || first))
+        {
+            first = false;
+            if (pattern[pos] == '\\')
+            {
+                pos++;
+                set.merge(parseEscape());
+                continue;
+            }
+
+            unsigned char lo = (unsigned char)pattern[pos++];
+            if (pos + 1 < pattern.size() && pattern[pos] == '-' && pattern[pos + 1] != ']')
+            {
+                unsigned char hi = (unsigned char)pattern[pos + 1];
+                if (hi < lo) fail("bad range in class");
+                set.setRange(lo, hi);
+                pos += 2;
+            }
+            else
+            {
+                set.set(lo);
+            }
+        }
+        if (!more()) fail("missing ]");
+        pos++;
+
+        if (negate) set.invert();
+        return set;
+    }
+
+    Piece parseAtom()
+    {
+        Piece p;
+        char c = pattern[pos++];
+        if (c == '(')
+        {
+            depth++;
+            p = parseAlt();
+            depth--;
+            if (!more() || pattern[pos] != ')') fail("missing )");
+            pos++;
+            return p;
+        }
+
+        CharSet set;
+        switch (c)
+        {
+            case '.':  set.invert(); break;
+            case '[':  set = parseClass(); break;
+            case '\\': set = parseEscape(); break;
+            case '*': case '+': case '?': fail("nothing to repeat"); break;
+            case '^': case '$': fail("anchors are only supported at the ends of top level branches"); break;
+            default:   set.set((unsigned char)c); break;
+        }
+
+        p.start = newState(CHAR);
+        nfa[p.start].set = set;
+        p.outs.push_back(p.start * 2);
+        return p;
+    }
+
+    Piece parseRepeat()
+    {
+        Piece p = parseAtom();
+        while (more() && (pattern[pos] == '*' || pattern[pos] == '+' || pattern[pos] == '?'))
+        {
+            char q = pattern[pos++];
+            int split = newState(SPLIT, p.start);
+            Piece r;
+            if (q == '*')
+            {
+                patch(p.outs, split);
+                r.start = split;
+            }
+            else if (q == '+')
+            {
+                patch(p.outs, split);
+                r.start = p.start;
+            }
+            else // '?'
+            {
+                r.start = split;
+                r.outs  = p.outs;
+            }
+            r.outs.push_back(split * 2 + 1);
+            p = r;
+        }
+        return p;
+    }
+
+    // A $ that ends a top level branch.
+    bool atEndAnchor() const
+    {
+        return depth == 0 && pattern[pos] == '$' &&
+               (pos + 1 == pattern.size() || pattern[pos + 1] == '|');
+    }
+
+    Piece parseConcat()
+    {
+        Piece p;
+        p.start = newState(EPS);
+        p.outs.push_back(p.start * 2);
+
+        while (more() && pattern[pos] != '|' && pattern[pos] != ')' && !atEndAnchor())
+        {
+            Piece next = parseRepeat();
+            patch(p.outs, next.start);
+            p.outs = next.outs;
+        }
+        return p;
+    }
+
+    Piece parseAlt()
+    {
+        Piece p = parseConcat();
+        while (more() && pattern[pos] == '|')
+        {
+            pos++;
+            Piece q = parseConcat();
+            Piece r;
+            r.start = newState(SPLIT, p.start, q.start);
+            r.outs  = p.outs;
+            r.outs.insert(r.outs.end(), q.outs.begin(), q.outs.end());
+            p = r;
+        }
+        return p;
+    }
+
+    // Add the CHAR and MATCH states reachable from s without consuming input.
+    void closure(int s, std::vector<int>& set, std::vector<char>& seen) const
+    {
+        if (s < 0 || seen[s]) return;
+        seen[s] = 1;
+
+        const NState& n = nfa[s];
+        if (n.kind == EPS)
+        {
+            closure(n.out, set, seen);
+        }
+        else if (n.kind == SPLIT)
+        {
+            closure(n.out, set, seen);
+            closure(n.out1, set, seen);
+        }
+        else
+        {
+            set.push_back(s);
+        }
+    }
+
+    int addState(Dfa& dfa, std::vector<int>& set)
+    {
+        std::sort(set.begin(), set.end());
+
+        std::map<std::vector<int>, int>::iterator it = dfa.cache.find(set);
+        if (it != dfa.cache.end())
+        {
+            return it->second;
+        }
+
+        if (dfa.dstates.size() >= max_states)
+        {
+            // Cache full: start over, the caller stops trusting earlier state ids.
+            dfa.dstates.clear();
+            dfa.cache.clear();
+            dfa.dstart = -1;
+            dfa.flushes++;
+        }
+
+        DState d;
+        d.nstates = set;
+        d.match = false;
+        d.match_end = false;
+        for (size_t i = 0; i < set.size(); i++)
+        {
+            d.match     |= (nfa[set[i]].kind == MATCH);
+            d.match_end |= (nfa[set[i]].kind == MATCH_END);
+        }
+        for (int c = 0; c < 256; c++)
+        {
+            d.next[c] = -1;
+        }
+        dfa.dstates.push_back(d);
+        dfa.cache[set] = (int)dfa.dstates.size() - 1;
+        return (int)dfa.dstates.size() - 1;
+    }
+
+    int startState(Dfa& dfa)
+    {
+        if (dfa.dstart < 0)
+        {
+            std::vector<int> set = start_set;
+            dfa.dstart = addState(dfa, set);
+        }
+        return dfa.dstart;
+    }
+
+    // Compute (and cache) the transition of DFA state d on byte c.
+    int step(Dfa& dfa, int d, unsigned char c)
+    {
+        std::vector<int> set;
+        std::vector<char> seen(nfa.size(), 0);
+        const std::vector<int>& from = dfa.dstates[d].nstates;
+        for (size_t i = 0; i < from.size(); i++)
+        {
+            const NState& n = nfa[from[i]];
+            if (n.kind == CHAR && n.set.test(c))
+            {
+                closure(n.out, set, seen);
+            }
+        }
+        // Branches without ^: a new match may begin at every byte.
+        for (size_t i = 0; i < restart_set.size(); i++)
+        {
+            if (!seen[restart_set[i]])
+            {
+                seen[restart_set[i]] = 1;
+                set.push_back(restart_set[i]);
+            }
+        }
+
+        return addState(dfa, set);
+    }
+
+public:
+    RegexMatcher(const std::string& pattern, size_t max_states = 256)
+    {
+        this->pattern    = pattern;
+        this->max_states = max_states < 2 ? 2 : max_states;
+        this->id         = nextId();
+        this->pos        = 0;
+        this->depth      = 0;
+
+        // Top level branches, each with its own anchors.
+        std::vector<int> starts, restarts;
+        while (true)
+        {
+            bool begin = more() && pattern[pos] == '^';
+            if (begin) pos++;
+            Piece p = parseConcat();
+            bool end = more() && pattern[pos] == '$';
+            if (end) pos++;
+            patch(p.outs, newState(end ? MATCH_END : MATCH));
+
+            starts.push_back(p.start);
+            if (!begin) restarts.push_back(p.start);
+            if (!more() || pattern[pos] != '|') break;
+            pos++;
+        }
+        if (more()) fail("unmatched )");
+
+        std::vector<char> seen(nfa.size(), 0);
+        for (size_t i = 0; i < starts.size(); i++)
+        {
+            closure(starts[i], start_set, seen);
+        }
+        seen.assign(nfa.size(), 0);
+        for (size_t i = 0; i < restarts.size(); i++)
+        {
+            closure(restarts[i], restart_set, seen);
+        }
+    }
+
+    // Other threads' DFAs go away with their threads; this one's goes away now.
+    ~RegexMatcher()
+    {
+        threadDfas().erase(id);
+    }
+
+    bool match(const std::string& s)
+    {
+        Dfa& dfa = threadDfas()[id];
+        std::vector<DState>& dstates = dfa.dstates;
+
+        int d = startState(dfa);
+        if (dstates[d].match)
+        {
+            return true;
+        }
+
+        for (size_t i = 0; i < s.size(); i++)
+        {
+            unsigned char c = (unsigned char)s[i];
+            int next = dstates[d].next[c];
+            if (next < 0)
+            {
+                size_t generation = dfa.flushes;
+                next = step(dfa, d, c);
+                // Only remember the edge if d was not flushed away meanwhile.
+                if (generation == dfa.flushes)
+                {
+                    dstates[d].next[c] = next;
+                }
+            }
+            d = next;
+
+            if (dstates[d].match)
+            {
+                return true;
+            }
+            if (dstates[d].nstates.empty())
+            {
+                return false; // dead state, only reachable when every branch has ^
+            }
+        }
+        return dstates[d].match_end;
+    }
+};
+
+// Cell of column in row, or NULL if the header has no such column. It never inserts into
+// header, so scan threads can share one.
+inline const std::string* findCell(const header_t& header, const row_t& row, const std::string& column)
+{
+    header_t::const_iterator it = header.find(column);
+    if (it == header.end() || (size_t)it->second >= row.size())
+    {
+        return NULL;
+    }
+    return &row[it->second];
+}
+
+// Position of column in header. Throws std::invalid_argument if there is no such column,
+// rather than adding it the way header[column] would.
+inline int columnNumber(const header_t& header, const std::string& column)
+{
+    header_t::const_iterator it = header.find(column);
+    if (it == header.end())
+    {
+        throw std::invalid_argument("unknown column \"" + column + "\"");
+    }
+    return it->second;
+}
+
+// Convert a cell to a typed value; false if the cell is NULL (empty) or not a valid value.
+inline bool parseCell(const std::string& cell, std::string& val)
+{
+    val = cell;
+    return !cell.empty();
+}
+
+// Integers are parsed like std::stoi (leading digits count), minus the exceptions.
+inline bool parseCell(const std::string& cell, int& val)
+{
+    const char* begin = cell.c_str();
+    char* end;
+
+    errno = 0;
+    long v = std::strtol(begin, &end, 10);
+    if (end == begin || errno == ERANGE || v < INT_MIN || v > INT_MAX)
+    {
+        return false;
+    }
+
+    val = (int)v;
+    return true;
+}
+
+// Floating point numbers are parsed like std::stod, minus the exceptions.
+inline bool parseCell(const std::string& cell, float& val)
+{
+    const char* begin = cell.c_str();
+    char* end;
+
+    errno = 0;
+    double v = std::strtod(begin, &end);
+    if (end == begin || errno == ERANGE)
+    {
+        return false;
+    }
+
+    val = (float)v;
+    return true;
+}
+
+// Literal as it would appear in SQL: strings quoted, floats with enough digits to round trip.
+inline std::string toLiteral(const std::string& val)
+{
+    std::string s = "'";
+    for (size_t i = 0; i < val.size(); i++)
+    {
+        s += val[i];
+        if (val[i] == '\'') s += '\'';
+    }
+    return s + "'";
+}
+
+template <typename T>
+inline std::string toLiteral(const T& val)
+{
+    std::ostringstream s;
+    s << std::setprecision(9) << val;
+    return s.str();
+}
+
+// Name of the type a cell is parsed to, for EXPLAIN.
+inline const char* typeName(const std::string&) { return "string"; }
+inline const char* typeName(const int&)         { return "int"; }
+inline const char* typeName(const float&)       { return "float"; }
+
+// Shortest text that parses back (like parseCell) to the same float, i.e. 0.1 and not
+// 0.100000001. Whole digits are kept below 1e9, so 20 prints as 20 and not 2e+01.
+inline std::string formatFloat(float val)
+{
+    char buf[32];
+    int digits = std::fabs(val) >= 1 && std::fabs(val) < 1e9f ? (int)std::log10(std::fabs(val)) + 1 : 1;
+    for (int precision = digits; precision < 9; precision++)
+    {
+        std::snprintf(buf, sizeof(buf), "%.*g", precision, val);
+        if ((float)std::strtod(buf, NULL) == val)
+        {
+            return buf;
+        }
+    }
+    std::snprintf(buf, sizeof(buf), "%.9g", val);
+    return buf;
+}
+
+// A typed column of a columnar table. Cells are stored as int, float or string; get()
+// converts to the type a condition asks for, giving the same value parseCell would give
+// for the cell's text. get() returns false for NULL, like parseCell.
+class Column
+{
+public:
+    static const int STRING = 0;
+    static const int INT    = 1;
+    static const int FLOAT  = 2;
+
+    virtual int type() const = 0;
+    virtual size_t size() const = 0;
+
+    virtual bool isNull(size_t row) const = 0;
+    virtual bool get(size_t row, int& val) const = 0;
+    virtual bool get(size_t row, float& val) const = 0;
+    virtual bool get(size_t row, std::string& val) const = 0;
+
+    // Set in out the bit of every row in rows whose integer value lies in [lo, hi], for an
+    // INT column that can test many rows at once. rows and out cover the rows from begin on:
+    // bit i is row begin + i. Return false to be read row by row instead, i.e. when begin
+    // is not a multiple of 64.
+    virtual bool selectRange(long long, long long, size_t, const Bitmap&, Bitmap&) const
+    {
+        return false;
+    }
+
+    // Run length encoded columns: a column holding one value per run, NULL for other encodings.
+    virtual const Column* runValues() const
+    {
+        return NULL;
+    }
+
+    // First row after run i.
+    virtual size_t runEnd(size_t) const
+    {
+        return 0;
+    }
+
+    virtual ~Column()
+    {
+        // nothing here, but required by polymorphism.
+    }
+};
+
+// Table stored column by column, i.e. a ColumnFile. Conditions evaluate on it by row number.
+class ColumnTable
+{
+public:
+    virtual size_t rows() const = 0;
+
+    // The named column, or NULL if there is none.
+    virtual const Column* column(const std::string& name) const = 0;
+
+    virtual ~ColumnTable()
+    {
+        // nothing here, but required by polymorphism.
+    }
+};
+
+// A single column seen as a table, i.e. the run values of a run length encoded column.
+class ColumnView: public ColumnTable
+{
+private:
+    std::string name;
+    const Column* col;
+
+public:
+    ColumnView(const std::string& name, const Column* col)
+    {
+        this->name = name;
+        this->col  = col;
+    }
+
+    size_t rows() const { return col->size(); }
+
+    const Column* column(const std::string& name) const
+    {
+        return name == this->name ? col : NULL;
+    }
+};
+
+// Base Condition class, to make sure all types of conditions can be invoked using the same base type.
+class ConditionBase
+{
+protected:
+    std::string column;
+    operator_t op;
+
+public:
+    ConditionBase(const std::string& column, operator_t op)
+    {
+        this->column = column;
+        this->op     = op;
+    }
+
+    const std::string& getColumn() const { return column; }
+    operator_t getOperator() const       { return op; }
+
+    // A table class should be defined to encapsulate table header and table rows,
+    // then the function parameter could be (table, row_index).
+    virtual logic_t eval3(header_t& header, row_t& row) = 0;
+
+    // Two-valued shortcut for filtering: UNKNOWN does not pass.
+    virtual bool eval(header_t& header, row_t& row)
+    {
+        return eval3(header, row) == Logic::TRUE;
+    }
+
+    // Same as above, for the row-th row of a columnar table.
+    virtual logic_t eval3(const ColumnTable& table, size_t row) = 0;
+
+    // Set in out the bit of every row in rows that satisfies the condition, i.e. evaluates
+    // to TRUE. rows and out cover the table rows from begin on: bit i is row begin + i.
+    // Conditions that can test a column segment at once override this.
+    // A run length encoded column is evaluated once per run, and a matching run sets its
+    // whole row range, so the cost follows the number of runs rather than rows.
+    virtual void select(const ColumnTable& table, size_t begin, const Bitmap& rows, Bitmap& out)
+    {
+        const Column* col = table.column(column);
+        const Column* values = col ? col->runValues() : NULL;
+        size_t end = begin + rows.size();
+        if (values)
+        {
+            // First run ending after begin, then the runs overlapping [begin, end).
+            size_t r = 0, last = values->size();
+            while (r < last)
+            {
+                size_t mid = r + (last - r) / 2;
+                if (col->runEnd(mid) <= begin) r = mid + 1; else last = mid;
+            }
+
+            ColumnView runs(column, values);
+            for (size_t from = begin; r < values->size() && from < end; r++)
+            {
+                size_t to = std::min(col->runEnd(r), end);
+                if (rows.next(from - begin) < to - begin && eval3(runs, r) == Logic::TRUE)
+                {
+                    out.orRange(rows, from - begin, to - begin);
+                }
+                from = to;
+            }
+            return;
+        }
+
+        for (size_t i = rows.next(0); i < rows.size(); i = rows.next(i + 1))
+        {
+            if (eval3(table, begin + i) == Logic::TRUE)
+            {
+                out.set(i);
+            }
+        }
+    }
+
+    // SQL text of the condition. i.e. name = 'John Doe'
+    virtual std::string toString() const = 0;
+
+    // EXPLAIN: how a row is tested, i.e. int compare or hash set of 50 values.
+    virtual std::string mode() const
+    {
+        return "compare";
+    }
+
+    // EXPLAIN: estimated fraction of the rows that satisfy the condition. Without column
+    // statistics to go by, these are the usual textbook guesses per operator.
+    virtual double selectivity() const
+    {
+        switch (op)
+        {
+            case Operator::EQ:          return 0.1;
+            case Operator::NE:          return 0.9;
+            case Operator::LT:
+            case Operator::LE:
+            case Operator::GT:
+            case Operator::GE:          return 1.0 / 3;
+            case Operator::BETWEEN:     return 0.25;
+            case Operator::IS_NULL:     return 0.05;
+            case Operator::IS_NOT_NULL: return 0.95;
+            default:                    return 0.1; // LIKE, ILIKE, REGEXP
+        }
+    }
+
+    // The condition that actually gets evaluated; wrappers return what they wrap.
+    virtual const ConditionBase* unwrap() const
+    {
+        return this;
+    }
+
+    // Identity of the condition: equal keys mean equal results on every row.
+    // The type tells age = 30 on int from age = 30 on float.
+    std::string key() const
+    {
+        const ConditionBase* target = unwrap();
+        return std::string(typeid(*target).name()) + ':' + toString();
+    }
+
+    virtual ~ConditionBase()
+    {
+        // nothing here, but required by polymorphism.
+    }
+};
+
+// Subclass for any type of conditions.
+template <typename T>
+class Condition: public ConditionBase
+{
+private:
+    T value;
+    LikeMatcher like;                    // compiled once for LIKE / ILIKE on strings
+    std::shared_ptr<RegexMatcher> regex; // compiled once for REGEXP on strings
+
+    // Patterns only make sense for strings.
+    void compile() {}
+    bool matchPattern(const T&) { return false; }
+
+protected:
+    // false if the cell is NULL (empty or missing) or does not convert to T.
+    bool getColumnValue(header_t& header, row_t& row, T& val)
+    {
+        const std::string* cell = findCell(header, row, column);
+        return cell && parseCell(*cell, val);
+    }
+
+public:
+    // construct a new condition. i.e. name = "John Doe"
+    Condition(const std::string& column, operator_t op, const T& value)
+        : ConditionBase(column, op)
+    {
+        this->value = value;
+        compile();
+    }
+
+    // construct a new unary condition. i.e. age IS NULL
+    Condition(const std::string& column, operator_t op)
+        : ConditionBase(column, op)
+    {
+        this->value = T();
+    }
+
+    const T& getValue() const { return value; }
+
+    std::string toString() const
+    {
+        if (op == Operator::IS_NULL || op == Operator::IS_NOT_NULL)
+        {
+            return column + ' ' + Operator::toString(op);
+        }
+        return column + ' ' + Operator::toString(op) + ' ' + toLiteral(value);
+    }
+
+    std::string mode() const
+    {
+        if (op == Operator::IS_NULL || op == Operator::IS_NOT_NULL)
+        {
+            return "empty cell check";
+        }
+        if (op == Operator::LIKE || op == Operator::ILIKE)
+        {
+            return like.describe();
+        }
+        if (op == Operator::REGEXP)
+        {
+            return "lazy DFA";
+        }
+        return std::string(typeName(value)) + " compare";
+    }
+
+    logic_t eval3(header_t& header, row_t& row)
+    {
+        if (op == Operator::IS_NULL || op == Operator::IS_NOT_NULL)
+        {
+            const std::string* cell = findCell(header, row, column);
+            bool null = !cell || cell->empty();
+            return (null == (op == Operator::IS_NULL)) ? Logic::TRUE : Logic::FALSE;
+        }
+
+        T val;
+        if (!getColumnValue(header, row, val))
+        {
+            return Logic::UNKNOWN; // NULL, or not a T
+        }
+        return test(val) ? Logic::TRUE : Logic::FALSE;
+    }
+
+    logic_t eval3(const ColumnTable& table, size_t row)
+    {
+        // A missing column reads as NULL, as on rows (findCell).
+        const Column* col = table.column(column);
+        if (op == Operator::IS_NULL || op == Operator::IS_NOT_NULL)
+        {
+            bool null = !col || col->isNull(row);
+            return (null == (op == Operator::IS_NULL)) ? Logic::TRUE : Logic::FALSE;
+        }
+
+        T val;
+        if (!col || !col->get(row, val))
+        {
+            return Logic::UNKNOWN;
+        }
+        return test(val) ? Logic::TRUE : Logic::FALSE;
+    }
+
+    // Integer conditions hand their range to the column, so an encoded column can test
+    // it on whole words; everything else goes row by row.
+    void select(const ColumnTable& table, size_t begin, const Bitmap& rows, Bitmap& out)
+    {
+        const Column* col = table.column(column);
+        long long lo, hi;
+        if (col && col->type() == Column::INT && bounds(lo, hi) && col->selectRange(lo, hi, begin, rows, out))
+        {
+            return;
+        }
+        ConditionBase::select(table, begin, rows, out);
+    }
+
+    // Integer values satisfying the condition as [lo, hi], false if they are not one range.
+    virtual bool bounds(long long&, long long&) const
+    {
+        return false;
+    }
+
+    // Compare a non-NULL value against the condition.
+    virtual bool test(const T& val)
+    {
+        bool result;
+        switch(op)
+        {
+            case Operator::EQ:     result = (val == value);   break;
+            case Operator::NE:     result = (val != value);   break;
+            case Operator::LT:     result = (val <  value);   break;
+            case Operator::LE:     result = (val <= value);   break;
+            case Operator::GT:     result = (val >  value);   break;
+            case Operator::GE:     result = (val >= value);   break;
+            case Operator::LIKE:
+            case Operator::ILIKE:
+            case Operator::REGEXP: result = matchPattern(val); break;
+            default:               result = false;            break;
+        }
+
+        // Debug
+        // std::cout << "#Debug: "
+        //           << column << ' ' << Operator::toString(op) << ' ' << value
+        //           << " -> " << column << " = " << val << " -> "
+        //           << (result ? "true" : "false") << std::endl;
+
+        return result;
+    }
+};
+
+template <>
+void Condition<std::string>::compile()
+{
+    if (op == Operator::LIKE || op == Operator::ILIKE)
+    {
+        like = LikeMatcher(value, op == Operator::ILIKE);
+    }
+    else if (op == Operator::REGEXP)
+    {
+        regex.reset(new RegexMatcher(value));
+    }
+}
+
+template <>
+bool Condition<std::string>::matchPattern(const std::string& val)
+{
+    return regex ? regex->match(val) : like.match(val);
+}
+
+template <>
+bool Condition<int>::bounds(long long& lo, long long& hi) const
+{
+    lo = INT_MIN;
+    hi = INT_MAX;
+    switch (op)
+    {
+        case Operator::EQ: lo = hi = value;  break;
+        case Operator::LT: hi = value - 1LL; break;
+        case Operator::LE: hi = value;       break;
+        case Operator::GT: lo = value + 1LL; break;
+        case Operator::GE: lo = value;       break;
+        default:           return false;
+    }
+    return true;
+}
+
+// column IN (v1, v2, ...). The list is compiled once: short lists into a small sorted
+// array, long ones into a hash set, and integers in a narrow range into a bitmap.
+template <typename T>
+class InCondition: public Condition<T>
+{
+private:
+    static const size_t SMALL = 16;
+
+    std::vector<T>        values; // sorted, duplicates removed
+    std::unordered_set<T> hashed; // only filled for long lists
+    Bitmap                dense;  // only filled for dense integer lists
+    long long             base;   // value of bit 0 in dense
+
+    // Only integers can go into the bitmap.
+    void compileDense() {}
+    bool containsDense(const T&) const { return false; }
+
+public:
+    // construct a new condition. i.e. company IN ("IBX", "Microsoft")
+    InCondition(const std::string& column, const std::vector<T>& values)
+        : Condition<T>(column, Operator::IN, T())
+    {
+        this->values = values;
+        std::sort(this->values.begin(), this->values.end());
+        this->values.erase(std::unique(this->values.begin(), this->values.end()), this->values.end());
+        this->base = 0;
+
+        compileDense();
+        if (dense.size() == 0 && this->values.size() > SMALL)
+        {
+            hashed.insert(this->values.begin(), this->values.end());
+        }
+    }
+
+    const std::vector<T>& getValues() const { return values; }
+
+    std::string toString() const
+    {
+        std::string s = this->column + " IN (";
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            s += (i ? ", " : "") + toLiteral(values[i]);
+        }
+        return s + ')';
+    }
+
+    std::string mode() const
+    {
+        std::string n = std::to_string(values.size());
+        if (dense.size())
+        {
+            return "bitmap of " + n + " values";
+        }
+        return (hashed.empty() ? "linear scan of " : "hash set of ") + n + " values";
+    }
+
+    double selectivity() const
+    {
+        return std::min(1.0, values.size() * 0.1);
+    }
+
+    bool contains(const T& val) const
+    {
+        if (dense.size())
+        {
+            return containsDense(val);
+        }
+        if (!hashed.empty())
+        {
+            return hashed.count(val) != 0;
+        }
+        // A handful of values: a branch-light linear scan beats hashing.
+        bool found = false;
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            found |= (values[i] == val);
+        }
+        return found;
+    }
+
+    bool test(const T& val)
+    {
+        return contains(val);
+    }
+};
+
+// Use a bitmap when it costs at most 64 bits per listed value.
+template <>
+void InCondition<int>::compileDense()
+{
+    if (values.empty())
+    {
+        return;
+    }
+
+    long long range = (long long)values.back() - values.front() + 1;
+    if (range <= 64 * (long long)values.size())
+    {
+        base  = values.front();
+        dense = Bitmap((size_t)range);
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            dense.set((size_t)(values[i] - base));
+        }
+    }
+}
+
+template <>
+bool InCondition<int>::containsDense(const int& val) const
+{
+    long long bit = (long long)val - base;
+    return bit >= 0 && bit < (long long)dense.size() && dense.test((size_t)bit);
+}
+
+// column BETWEEN lo AND hi, both ends inclusive. One cell extraction for both bounds.
+template <typename T>
+class BetweenCondition: public Condition<T>
+{
+private:
+    T lo;
+    T hi;
+
+    bool inRange(const T& val) const
+    {
+        return (val >= lo) & (val <= hi);
+    }
+
+public:
+    // construct a new condition. i.e. age BETWEEN 30 AND 60
+    BetweenCondition(const std::string& column, const T& lo, const T& hi)
+        : Condition<T>(column, Operator::BETWEEN, lo)
+    {
+        this->lo = lo;
+        this->hi = hi;
+    }
+
+    const T& getLow() const  { return lo; }
+    const T& getHigh() const { return hi; }
+
+    bool bounds(long long&, long long&) const
+    {
+        return false;
+    }
+
+    std::string toString() const
+    {
+        return this->column + " BETWEEN " + toLiteral(lo) + " AND " + toLiteral(hi);
+    }
+
+    std::string mode() const
+    {
+        return std::string(typeName(lo)) + " range check, branchless";
+    }
+
+    bool test(const T& val)
+    {
+        return inRange(val);
+    }
+};
+
+// Integers need a single unsigned compare: values below lo wrap around to huge numbers.
+// An empty range (lo > hi) would wrap too, so it is ruled out first.
+template <>
+inline bool BetweenCondition<int>::inRange(const int& val) const
+{
+    return lo <= hi && (unsigned long long)((long long)val - lo) <= (unsigned long long)((long long)hi - lo);
+}
+
+template <>
+inline bool BetweenCondition<int>::bounds(long long& lo, long long& hi) const
+{
+    lo = this->lo;
+    hi = this->hi;
+    return true;
+}
+
+// Closest value above / below v, false when there is none. Turns > and < into inclusive bounds.
+inline bool nextUp(int& v)     { if (v == INT_MAX) return false; v++; return true; }
+inline bool nextDown(int& v)   { if (v == INT_MIN) return false; v--; return true; }
+inline bool nextUp(float& v)   { v = std::nextafter(v,  INFINITY); return !std::isinf(v); }
+inline bool nextDown(float& v) { v = std::nextafter(v, -INFINITY); return !std::isinf(v); }
+
+// Fuse a lower and an upper bound on the same column into one BETWEEN, or return NULL.
+template <typename T>
+ConditionBase* fuseRange(ConditionBase* a, ConditionBase* b)
+{
+    Condition<T>* ca = dynamic_cast<Condition<T>*>(a);
+    Condition<T>* cb = dynamic_cast<Condition<T>*>(b);
+    if (!ca || !cb || ca->getColumn() != cb->getColumn())
+    {
+        return NULL;
+    }
+
+    operator_t opa = ca->getOperator();
+    if (opa == Operator::LT || opa == Operator::LE)
+    {
+        std::swap(ca, cb); // lower bound first
+    }
+
+    T lo = ca->getValue();
+    T hi = cb->getValue();
+    operator_t lo_op = ca->getOperator();
+    operator_t hi_op = cb->getOperator();
+    if (!(lo_op == Operator::GT || lo_op == Operator::GE) || !(hi_op == Operator::LT || hi_op == Operator::LE))
+    {
+        return NULL;
+    }
+    if ((lo_op == Operator::GT && !nextUp(lo)) || (hi_op == Operator::LT && !nextDown(hi)))
+    {
+        return NULL;
+    }
+
+    return new BetweenCondition<T>(ca->getColumn(), lo, hi);
+}
+
+class SharedCondition;
+
+// Hash-conses conditions shared by many clauses. Identical conditions (same type, column,
+// operator and literal) are stored once. Between BeginRow() calls their result is remembered,
+// so every clause referencing gender = 'female' reuses one evaluation per row: the driver
+// calls BeginRow() before evaluating the clauses on each row. Until the first BeginRow() and
+// after Reset(), nothing is remembered and every evaluation runs.
+// The registry must outlive the clauses built from it.
+class ConditionRegistry
+{
+private:
+    struct Entry
+    {
+        ConditionBase* condition; // owned
+        uint64_t       generation; // row the result belongs to
+        logic_t        result;
+    };
+
+    std::unordered_map<std::string, size_t> ids;
+    std::vector<Entry> entries;
+    uint64_t generation; // current row, advanced by BeginRow()
+    bool     remember;   // inside a row started with BeginRow()
+    size_t evaluations;
+
+public:
+    ConditionRegistry()
+    {
+        generation  = 1;
+        remember    = false;
+        evaluations = 0;
+    }
+
+    ~ConditionRegistry()
+    {
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            delete entries[i].condition;
+        }
+    }
+
+    // Take ownership of c and return a condition for a Where clause that evaluates
+    // through the shared copy. c is deleted right away if an identical one exists.
+    ConditionBase* Share(ConditionBase* c);
+
+    // Start a new row: results remembered so far belong to the previous one.
+    void BeginRow()
+    {
+        generation++;
+        remember = true;
+    }
+
+    // Forget all remembered results, and stop remembering until the next BeginRow().
+    void Reset()
+    {
+        generation++;
+        remember = false;
+    }
+
+    logic_t eval3(size_t id, header_t& header, row_t& row)
+    {
+        Entry& e = entries[id];
+        if (!remember || e.generation != generation)
+        {
+            e.result     = e.condition->eval3(header, row);
+            e.generation = remember ? generation : 0;
+            evaluations++;
+        }
+        return e.result;
+    }
+
+    logic_t eval3(size_t id, const ColumnTable& table, size_t row)
+    {
+        evaluations++;
+        return entries[id].condition->eval3(table, row);
+    }
+
+    const ConditionBase* get(size_t id) const { return entries[id].condition; }
+
+    size_t size() const        { return entries.size(); } // distinct conditions
+    size_t evaluated() const   { return evaluations; }    // evaluations actually run
+};
+
+// Stand-in a Where clause owns for a condition kept in a ConditionRegistry.
+class SharedCondition: public ConditionBase
+{
+private:
+    ConditionRegistry& registry;
+    size_t id;
+
+public:
+    SharedCondition(ConditionRegistry& registry, size_t id)
+        : ConditionBase(registry.get(id)->getColumn(), registry.get(id)->getOperator()),
+          registry(registry), id(id)
+    {
+    }
+
+    logic_t eval3(header_t& header, row_t& row)
+    {
+        return registry.eval3(id, header, row);
+    }
+
+    // Columnar rows have no address to remember results by, evaluate directly.
+    logic_t eval3(const ColumnTable& table, size_t row)
+    {
+        return registry.eval3(id, table, row);
+    }
+
+    std::string toString() const
+    {
+        return registry.get(id)->toString();
+    }
+
+    std::string mode() const
+    {
+        return registry.get(id)->mode() + ", shared, once per row";
+    }
+
+    double selectivity() const
+    {
+        return registry.get(id)->selectivity();
+    }
+
+    const ConditionBase* unwrap() const
+    {
+        return registry.get(id)->unwrap();
+    }
+
+    ConditionRegistry& getRegistry() const { return registry; }
+};
+
+inline ConditionBase* ConditionRegistry::Share(ConditionBase* c)
+{
+    std::string key = c->key();
+
+    std::unordered_map<std::string, size_t>::iterator it = ids.find(key);
+    if (it != ids.end())
+    {
+        delete c;
+        return new SharedCondition(*this, it->second);
+    }
+
+    Entry e;
+    e.condition  = c;
+    e.generation = 0;
+    e.result     = Logic::UNKNOWN;
+    entries.push_back(e);
+    ids[key] = entries.size() - 1;
+
+    return new SharedCondition(*this, entries.size() - 1);
+}
+
+// Base index class. An index narrows the rows a condition can possibly match, so the scan
+// only has to run Where::eval on the survivors.
+class Index
+{
+public:
+    // Rows of the table when the index was built. An index of another size describes
+    // another table (i.e. one rows were appended to since) and must not be used.
+    virtual size_t rowCount() const = 0;
+
+    // Set the bit of every row that may satisfy c in rows (all bits clear on entry).
+    // Return false if this index knows nothing about c; rows is ignored then.
+    virtual bool filter(const ConditionBase& c, Bitmap& rows) const = 0;
+
+    // True if the rows filter() sets for c are exactly the rows satisfying c,
+    // so they need no further evaluation.
+    virtual bool exact(const ConditionBase&) const
+    {
+        return false;
+    }
+
+    // EXPLAIN: true if filter() narrows c, decided from c alone without reading the index.
+    virtual bool covers(const ConditionBase&) const
+    {
+        return false;
+    }
+
+    // EXPLAIN: name of the index, i.e. bloom(company).
+    virtual std::string name() const
+    {
+        return "index";
+    }
+
+    virtual ~Index()
+    {
+        // nothing here, but required by polymorphism.
+    }
+};
+
+// Bump allocator for objects that die together, i.e. the conditions of many clauses:
+// objects are placed back to back in large blocks, so a clause's conditions share cache
+// lines instead of being scattered over the heap, and all of them are destroyed (in
+// reverse order of creation) and freed in one go with the arena.
+class Arena
+{
+private:
+    struct Object
+    {
+        void* object;
+        void (*destroy)(void*);
+    };
+
+    std::vector<char*>  blocks;
+    std::vector<Object> objects;    // in order of creation
+    size_t block_size;
+    size_t capacity;                // bytes in the last block
+    size_t used;                    // bytes taken in the last block
+    size_t bytes;                   // bytes handed out in all blocks
+
+    template <typename T>
+    static void destroy(void* p)
+    {
+        static_cast<T*>(p)->~T();
+    }
+
+    void* allocate(size_t size, size_t align)
+    {
+        size_t offset = (used + align - 1) & ~(align - 1);
+        if (blocks.empty() || offset + size > capacity)
+        {
+            size_t n = std::max(block_size, size + align);
+            char* block = static_cast<char*>(::operator new(n));
+            try
+            {
+                blocks.push_back(block);
+            }
+            catch (...)
+            {
+                ::operator delete(block);
+                throw;
+            }
+            capacity = n;
+            offset   = 0;
+        }
+        used   = offset + size;
+        bytes += size;
+        return blocks.back() + offset;
+    }
+
+public:
+    explicit Arena(size_t block_size = 32 << 10)
+    {
+        this->block_size = block_size;
+        this->capacity   = 0;
+        this->used       = 0;
+        this->bytes      = 0;
+    }
+
+    ~Arena()
+    {
+        for (size_t i = objects.size(); i-- > 0; )
+        {
+            objects[i].destroy(objects[i].object);
+        }
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            ::operator delete(blocks[i]);
+        }
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Construct a T in the arena. It lives until the arena is destroyed: never delete it.
+    template <typename T, typename... Args>
+    T* Create(Args&&... args)
+    {
+        if (objects.size() == objects.capacity())
+        {
+            objects.reserve(objects.size() * 2 + 16); // registering below cannot throw then
+        }
+        void* p = allocate(sizeof(T), alignof(T));
+        T* object = new (p) T(std::forward<Args>(args)...);
+        Object o = {object, &Arena::destroy<T>};
+        objects.push_back(o);
+        return object;
+    }
+
+    size_t bytesUsed() const  { return bytes; }
+    size_t blockCount() const { return blocks.size(); }
+};
+
+// Counters gathered by Where::analyze(), for the conditions and the AND groups of one
+// clause. Only every sample_every-th row is measured; the others are evaluated as usual.
+class Profile
+{
+public:
+    struct Counters
+    {
+        size_t evaluations;
+        size_t passes;   // evaluated to TRUE
+        size_t nulls;    // UNKNOWN because the cell is empty (conditions only)
+        size_t failures; // UNKNOWN because the cell does not convert, or the column is missing
+        double seconds;
+    };
+
+private:
+    size_t sample_every;
+    size_t seen;
+    size_t sampled;
+    size_t passed;
+    double seconds;
+    std::vector<Counters> conditions;
+    std::vector<Counters> groups;
+
+    friend class Where;
+
+public:
+    explicit Profile(size_t sample_every = 1)
+    {
+        this->sample_every = sample_every ? sample_every : 1;
+        Reset();
+    }
+
+    void Reset()
+    {
+        seen    = 0;
+        sampled = 0;
+        passed  = 0;
+        seconds = 0;
+        conditions.clear();
+        groups.clear();
+    }
+
+    size_t rowsSeen() const    { return seen; }
+    size_t rowsSampled() const { return sampled; }
+    size_t rowsPassed() const  { return passed; }   // of the sampled rows
+    double totalSeconds() const { return seconds; } // over the sampled rows
+
+    const std::vector<Counters>& conditionCounters() const { return conditions; }
+    const std::vector<Counters>& groupCounters() const     { return groups; }
+};
+
+// Where Clause
+class Where
+{
+private:
+    std::vector<ConditionBase*> conditions;  // all conditions in the clause
+    std::vector<operator_t>     operators;   // all operators in the clause
+    std::vector<bool>           pooled;      // condition i is not owned: it lives in the arena,
+                                             // or in the clause this one is a plan of
+    Arena*                      arena;       // where Emplace() puts conditions, or NULL
+
+    // Take c into the clause. Nothing is added if this throws; the caller still owns c.
+    void add(ConditionBase* c, bool in_arena)
+    {
+        conditions.reserve(conditions.size() + 1);
+        pooled.reserve(pooled.size() + 1);
+        conditions.push_back(c);
+        pooled.push_back(in_arena);
+    }
+
+    // Planner pass: within each AND group, fuse a lower and an upper bound on the same
+    // numeric column into a single BETWEEN, i.e. age > 30 AND age <= 60 -> age BETWEEN 31 AND 60.
+    // Only run on plans (see Plan()): the fused conditions replace borrowed ones, which
+    // stay with the clause the plan was made from.
+    void Optimize()
+    {
+        size_t group = 0; // first condition of the current AND group
+        for (size_t i = 0; i < conditions.size(); i++)
+        {
+            if (i > 0 && operators[i - 1] == Operator::OR)
+            {
+                group = i;
+            }
+
+            for (size_t j = group; j < i; j++)
+            {
+                ConditionBase* fused = fuseRange<int>(conditions[j], conditions[i]);
+                if (!fused)
+                {
+                    fused = fuseRange<float>(conditions[j], conditions[i]);
+                }
+                if (fused)
+                {
+                    // conditions[i] is ANDed with its predecessor, drop both.
+                    // Borrowed and pooled ones are not this clause's to delete.
+                    if (!pooled[j]) delete conditions[j];
+                    if (!pooled[i]) delete conditions[i];
+                    conditions[j] = fused;
+                    pooled[j] = false;
+                    conditions.erase(conditions.begin() + i);
+                    pooled.erase(pooled.begin() + i);
+                    operators.erase(operators.begin() + (i - 1));
+                    i--;
+                    break;
+                }
+            }
+        }
+    }
+
+    // i.e. evaluations 1000, passes 120 (12.0%), 180.5 ns/eval
+    static void counters(std::ostream& s, const Profile::Counters& c)
+    {
+        s << "evaluations " << c.evaluations << ", passes " << c.passes;
+        if (c.evaluations)
+        {
+            s << " (" << 100.0 * c.passes / c.evaluations << "%), "
+              << c.seconds / c.evaluations * 1e9 << " ns/eval";
+        }
+    }
+
+public:
+    Where()
+    {
+        arena = NULL;
+    }
+
+    // Conditions made with Emplace() go into arena, which must outlive the clause.
+    // Share one arena among many clauses to keep all their conditions together.
+    explicit Where(Arena* arena)
+    {
+        this->arena = arena;
+    }
+
+    ~Where()
+    {
+        for (size_t i = 0; i < conditions.size(); i++)
+        {
+            if (!pooled[i])
+            {
+                delete conditions[i];
+            }
+        }
+    }
+
+    // Take ownership of a condition allocated with new. It is deleted if this throws.
+    Where* AddCondition(ConditionBase* c)
+    {
+        try
+        {
+            add(c, false);
+        }
+        catch (...)
+        {
+            delete c;
+            throw;
+        }
+        return this;
+    }
+
+    // Construct a condition in place, in the clause's arena if it has one, i.e.
+    // where.Emplace<Condition<int> >("age", Operator::GT, 30). Nothing leaks if this throws.
+    template <typename C, typename... Args>
+    Where* Emplace(Args&&... args)
+    {
+        if (arena)
+        {
+            add(arena->Create<C>(std::forward<Args>(args)...), true); // the arena cleans up on throw
+            return this;
+        }
+        std::unique_ptr<C> c(new C(std::forward<Args>(args)...));
+        add(c.get(), false);
+        c.release();
+        return this;
+    }
+
+    Where* AddOperator(operator_t op)
+    {
+        operators.push_back(op);
+        return this;
+    }
+
+    // The clause as Scan, the streams and the file readers run it: the same conditions,
+    // with range pairs fused into BETWEEN. The plan borrows the conditions it keeps, so
+    // this clause is never changed and must outlive the plan.
+    std::unique_ptr<Where> Plan() const
+    {
+        std::unique_ptr<Where> plan(new Where());
+        plan->conditions = conditions;
+        plan->operators  = operators;
+        plan->pooled.assign(conditions.size(), true);
+        plan->Optimize();
+        return plan;
+    }
+
+    // A table class should be defined to encapsulate table header and table rows,
+    // then the function parameter could be (table, row_index, op_index).
+    bool eval(header_t& header, row_t& row)
+    {
+        bool result = conditions[0]->eval(header, row);
+
+        size_t op_index = 0;
+        while(op_index < operators.size())
+        {
+            if (operators[op_index] == Operator::AND)
+            {
+                op_index++;
+
+                // If one operand of AND is false, skip :)
+                if (result)
+                {
+                    result = conditions[op_index]->eval(header, row);
+                }
+                else
+                {
+                    continue;
+                }
+            }
+            else // OR
+            {
+                op_index++;
+
+                // If one operand of OR is true, stop here :)
+                if (result)
+                {
+                    return true;
+                }
+                else
+                {
+                    result = conditions[op_index]->eval(header, row);
+                    continue;
+                }
+            }
+        }
+
+        return result;
+    }
+
+    // The clause as an OR of AND groups (AND binds tighter than OR).
+    std::vector<std::vector<ConditionBase*> > groups() const
+    {
+        std::vector<std::vector<ConditionBase*> > result;
+        for (size_t i = 0; i < conditions.size(); i++)
+        {
+            if (i == 0 || operators[i - 1] == Operator::OR)
+            {
+                result.push_back(std::vector<ConditionBase*>());
+            }
+            result.back().push_back(conditions[i]);
+        }
+        return result;
+    }
+
+    // SQL text of the clause. i.e. name = 'John Doe' AND age > 30
+    std::string toString() const
+    {
+        std::string s;
+        for (size_t i = 0; i < conditions.size(); i++)
+        {
+            if (i > 0)
+            {
+                s += ' ' + Operator::toString(operators[i - 1]) + ' ';
+            }
+            s += conditions[i]->toString();
+        }
+        return s;
+    }
+
+    // Canonical form of the clause: conditions sorted within each AND group, groups sorted,
+    // duplicates dropped. Clauses that differ only in such order have the same fingerprint.
+    std::string fingerprint() const
+    {
+        std::vector<std::string> keys;
+        std::vector<std::vector<ConditionBase*> > conjunctions = groups();
+        for (size_t g = 0; g < conjunctions.size(); g++)
+        {
+            std::vector<std::string> group;
+            for (size_t i = 0; i < conjunctions[g].size(); i++)
+            {
+                group.push_back(conjunctions[g][i]->key());
+            }
+            std::sort(group.begin(), group.end());
+            group.erase(std::unique(group.begin(), group.end()), group.end());
+
+            std::string joined;
+            for (size_t i = 0; i < group.size(); i++)
+            {
+                joined += group[i] + '\n';
+            }
+            keys.push_back(joined);
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+        std::string result;
+        for (size_t i = 0; i < keys.size(); i++)
+        {
+            result += keys[i] + "OR\n";
+        }
+        return result;
+    }
+
+    // Same clause under SQL three-valued logic: TRUE, FALSE, or UNKNOWN when NULLs leave it open.
+    logic_t eval3(header_t& header, row_t& row)
+    {
+        logic_t result = Logic::FALSE;
+        logic_t group  = conditions[0]->eval3(header, row);
+
+        for (size_t i = 1; i < conditions.size(); i++)
+        {
+            if (operators[i - 1] == Operator::OR)
+            {
+                result = Logic::Or(result, group);
+                if (result == Logic::TRUE)
+                {
+                    return result;
+                }
+                group = conditions[i]->eval3(header, row);
+            }
+            else if (group != Logic::FALSE) // FALSE AND x is FALSE, skip x
+            {
+                group = Logic::And(group, conditions[i]->eval3(header, row));
+            }
+        }
+
+        return Logic::Or(result, group);
+    }
+
+    // EXPLAIN: how candidates() and a row scan would find the matching rows with these
+    // indexes. Decided from the conditions alone, no index is read.
+    std::string accessPath(const std::vector<Index*>& indexes) const
+    {
+        bool every_group = true; // every group narrowed by some index
+        bool answered = true;    // every condition answered exactly by an index
+        std::vector<std::vector<ConditionBase*> > conjunctions = groups();
+        for (size_t g = 0; g < conjunctions.size(); g++)
+        {
+            bool narrowed = false;
+            for (size_t i = 0; i < conjunctions[g].size(); i++)
+            {
+                bool exact = false;
+                for (size_t j = 0; j < indexes.size(); j++)
+                {
+                    if (indexes[j]->covers(*conjunctions[g][i]))
+                    {
+                        narrowed = true;
+                        exact |= indexes[j]->exact(*conjunctions[g][i]);
+                    }
+                }
+                answered &= exact;
+            }
+            every_group &= narrowed;
+        }
+
+        if (!every_group)
+        {
+            return "full scan, row by row";
+        }
+        return answered ? "index bitmaps only, no row is read"
+                        : "index bitmaps narrow the rows, then row by row";
+    }
+
+    // EXPLAIN: the clause as it would run, without evaluating it. AND groups are tried in
+    // order until one is TRUE, and the conditions of a group in order until one is not;
+    // the step numbers follow that order. Selectivities are estimates that take the
+    // conditions as independent. With indexes, each condition lists those that narrow it.
+    std::string explain(const std::vector<Index*>& indexes = std::vector<Index*>()) const
+    {
+        std::vector<std::vector<ConditionBase*> > conjunctions = groups();
+        std::vector<double> estimates(conjunctions.size(), 1.0);
+        double none = 1.0; // chance that no group matches
+        for (size_t g = 0; g < conjunctions.size(); g++)
+        {
+            for (size_t i = 0; i < conjunctions[g].size(); i++)
+            {
+                estimates[g] *= conjunctions[g][i]->selectivity();
+            }
+            none *= 1 - estimates[g];
+        }
+
+        std::ostringstream s;
+        s << std::fixed << std::setprecision(3);
+        s << "EXPLAIN " << toString() << '\n'
+          << "OR  est. " << 1 - none << '\n';
+
+        for (size_t g = 0, step = 1; g < conjunctions.size(); g++)
+        {
+            s << "  AND  est. " << estimates[g] << '\n';
+            for (size_t i = 0; i < conjunctions[g].size(); i++, step++)
+            {
+                const ConditionBase* c = conjunctions[g][i];
+                s << "    " << step << ". " << c->toString() << "  est. " << c->selectivity()
+                  << ", " << c->mode();
+                for (size_t j = 0; j < indexes.size(); j++)
+                {
+                    if (indexes[j]->covers(*c))
+                    {
+                        s << ", " << indexes[j]->name() << (indexes[j]->exact(*c) ? " exact" : "");
+                    }
+                }
+                s << '\n';
+            }
+        }
+        return s.str();
+    }
+
+    // eval3() that also fills profile with what each condition and AND group cost.
+    // A separate path, so eval() and eval3() pay nothing for it. Rows that are not
+    // sampled go through eval3() untouched.
+    logic_t analyze(header_t& header, row_t& row, Profile& profile)
+    {
+        if (profile.seen++ % profile.sample_every != 0)
+        {
+            return eval3(header, row);
+        }
+
+        if (profile.conditions.size() != conditions.size())
+        {
+            Profile::Counters zero = {0, 0, 0, 0, 0};
+            profile.conditions.assign(conditions.size(), zero);
+            profile.groups.assign(groups().size(), zero);
+        }
+
+        // One clock read per condition: each one is timed from the end of the previous.
+        typedef std::chrono::steady_clock clock;
+        clock::time_point start = clock::now();
+        clock::time_point last  = start;
+        size_t g = 0;
+
+        logic_t result = Logic::FALSE;
+        logic_t group  = Logic::TRUE;
+        for (size_t i = 0; i < conditions.size(); i++)
+        {
+            if (i > 0 && operators[i - 1] == Operator::OR)
+            {
+                profile.groups[g].evaluations++;
+                profile.groups[g].passes += group == Logic::TRUE;
+                result = Logic::Or(result, group);
+                if (result == Logic::TRUE)
+                {
+                    break;
+                }
+                group = Logic::TRUE;
+                g++;
+            }
+            if (group == Logic::FALSE) // FALSE AND x is FALSE, skip x
+            {
+                continue;
+            }
+
+            logic_t value = conditions[i]->eval3(header, row);
+            clock::time_point now = clock::now();
+            double seconds = std::chrono::duration<double>(now - last).count();
+            last = now;
+
+            Profile::Counters& c = profile.conditions[i];
+            c.seconds += seconds;
+            profile.groups[g].seconds += seconds;
+            c.evaluations++;
+            c.passes += value == Logic::TRUE;
+            if (value == Logic::UNKNOWN)
+            {
+                // A missing column reads as NULL, but a typo is worth telling apart.
+                const std::string* cell = findCell(header, row, conditions[i]->getColumn());
+                if (cell && cell->empty())
+                {
+                    c.nulls++;
+                }
+                else
+                {
+                    c.failures++;
+                }
+            }
+            group = Logic::And(group, value);
+        }
+
+        if (result != Logic::TRUE) // the last group was not closed by an OR
+        {
+            profile.groups[g].evaluations++;
+            profile.groups[g].passes += group == Logic::TRUE;
+            result = Logic::Or(result, group);
+        }
+
+        profile.sampled++;
+        profile.passed  += result == Logic::TRUE;
+        profile.seconds += std::chrono::duration<double>(last - start).count();
+        return result;
+    }
+
+    // EXPLAIN ANALYZE: the clause as an OR of AND groups, each line with what analyze()
+    // measured for it. Times are per evaluation; pass rates are of the evaluations.
+    std::string explainAnalyze(const Profile& profile) const
+    {
+        std::ostringstream s;
+        s << std::fixed << std::setprecision(1);
+        s << "EXPLAIN ANALYZE " << toString() << '\n'
+          << "rows " << profile.seen << ", sampled " << profile.sampled
+          << ", passed " << profile.passed;
+        if (profile.sampled)
+        {
+            s << " (" << 100.0 * profile.passed / profile.sampled << "%), "
+              << profile.seconds / profile.sampled * 1e9 << " ns/row";
+        }
+        s << '\n';
+        if (profile.conditions.size() != conditions.size())
+        {
+            return s.str(); // nothing sampled yet
+        }
+
+        std::vector<std::vector<ConditionBase*> > conjunctions = groups();
+        s << "OR\n";
+        for (size_t g = 0, i = 0; g < conjunctions.size(); g++)
+        {
+            s << "  AND  ";
+            counters(s, profile.groups[g]);
+            s << '\n';
+            for (size_t j = 0; j < conjunctions[g].size(); j++, i++)
+            {
+                const Profile::Counters& c = profile.conditions[i];
+                s << "    " << conditions[i]->toString() << "  ";
+                counters(s, c);
+                if (c.nulls || c.failures)
+                {
+                    s << ", nulls " << c.nulls << ", failures " << c.failures;
+                }
+                s << '\n';
+            }
+        }
+        return s.str();
+    }
+
+    // Same as above, for the row-th row of a columnar table.
+    logic_t eval3(const ColumnTable& table, size_t row)
+    {
+        logic_t result = Logic::FALSE;
+        logic_t group  = conditions[0]->eval3(table, row);
+
+        for (size_t i = 1; i < conditions.size(); i++)
+        {
+            if (operators[i - 1] == Operator::OR)
+            {
+                result = Logic::Or(result, group);
+                if (result == Logic::TRUE)
+                {
+                    return result;
+                }
+                group = conditions[i]->eval3(table, row);
+            }
+            else if (group != Logic::FALSE)
+            {
+                group = Logic::And(group, conditions[i]->eval3(table, row));
+            }
+        }
+
+        return Logic::Or(result, group);
+    }
+
+    // Rows of a columnar table that pass the clause.
+    Bitmap select(const ColumnTable& table)
+    {
+        return select(table, 0, table.rows());
+    }
+
+    // Rows [begin, end) of a columnar table that pass the clause, bit i for row begin + i,
+    // evaluated a condition at a time: each condition of an AND group only looks at the
+    // rows the previous ones kept, and a group only at the rows no earlier group matched.
+    Bitmap select(const ColumnTable& table, size_t begin, size_t end)
+    {
+        size_t n = end - begin;
+        Bitmap result(n);
+        std::vector<std::vector<ConditionBase*> > conjunctions = groups();
+        for (size_t g = 0; g < conjunctions.size(); g++)
+        {
+            Bitmap rows = result;
+            rows.flip();
+            for (size_t i = 0; i < conjunctions[g].size(); i++)
+            {
+                Bitmap kept(n);
+                conjunctions[g][i]->select(table, begin, rows, kept);
+                std::swap(rows, kept);
+            }
+            result |= rows;
+        }
+        return result;
+    }
+
+    // Rows that may satisfy the clause according to the given indexes.
+    // AND binds tighter than OR, so the clause is an OR of AND groups:
+    // intersect the candidates within a group, then union the groups.
+    // If sure is given, it receives the rows the indexes alone prove to match, i.e. the
+    // rows of groups whose every condition was answered exactly.
+    Bitmap candidates(const std::vector<Index*>& indexes, size_t rows, Bitmap* sure = NULL)
+    {
+        Bitmap result(rows);
+        Bitmap group(rows, true);
+        bool group_exact = true;
+
+        if (sure)
+        {
+            *sure = Bitmap(rows);
+        }
+
+        for (size_t i = 0; i < conditions.size(); i++)
+        {
+            if (i > 0 && operators[i - 1] == Operator::OR)
+            {
+                result |= group;
+                if (sure && group_exact) *sure |= group;
+                group.fill(true);
+                group_exact = true;
+            }
+
+            bool condition_exact = false;
+            for (size_t j = 0; j < indexes.size(); j++)
+            {
+                if (indexes[j]->rowCount() != rows)
+                {
+                    continue; // built for a table of another size, stale
+                }
+                Bitmap narrowed(rows);
+                if (indexes[j]->filter(*conditions[i], narrowed))
+                {
+                    group &= narrowed;
+                    condition_exact |= indexes[j]->exact(*conditions[i]);
+                }
+            }
+            group_exact &= condition_exact;
+        }
+        result |= group;
+        if (sure && group_exact) *sure |= group;
+
+        return result;
+    }
+};
+
+// Split block Bloom filter: every key sets 8 bits inside a single 32-byte block,
+// so a lookup touches one cache line.
+class BloomFilter
+{
+private:
+    std::vector<uint32_t> words; // 8 words per block
+
+    static uint32_t mask(uint32_t key, int i)
+    {
+        static const uint32_t salt[8] = {
+            0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+            0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+        };
+        return 1U << ((key * salt[i]) >> 27);
+    }
+
+    size_t block(uint64_t h) const
+    {
+        return (size_t)(((h >> 32) * (words.size() / 8)) >> 32);
+    }
+
+public:
+    // bytes is rounded up to whole 32-byte blocks.
+    BloomFilter(size_t bytes = 32)
+    {
+        words.assign(((bytes + 31) / 32) * 8, 0);
+    }
+
+    // Load a filter stored from getWords(); empty or partial blocks are rejected.
+    explicit BloomFilter(const std::vector<uint32_t>& words)
+    {
+        if (words.empty() || words.size() % 8)
+        {
+            throw std::invalid_argument("bad Bloom filter size");
+        }
+        this->words = words;
+    }
+
+    size_t bytes() const { return words.size() * 4; }
+
+    const std::vector<uint32_t>& getWords() const { return words; }
+
+    void add(const std::string& key)
+    {
+        uint64_t h = hashString(key);
+        uint32_t* b = &words[block(h) * 8];
+        for (int i = 0; i < 8; i++) b[i] |= mask((uint32_t)h, i);
+    }
+
+    bool mayContain(const std::string& key) const
+    {
+        uint64_t h = hashString(key);
+        const uint32_t* b = &words[block(h) * 8];
+        for (int i = 0; i < 8; i++)
+        {
+            if (!(b[i] & mask((uint32_t)h, i))) return false;
+        }
+        return true;
+    }
+
+    // Size for n keys at the requested false positive rate (classic m = -n ln p / ln^2 2 estimate).
+    static size_t bytesFor(size_t n, double fpp)
+    {
+        double bits = -(double)(n ? n : 1) * std::log(fpp) / (std::log(2.0) * std::log(2.0));
+        return (size_t)std::ceil(bits / 8);
+    }
+};
+
+// One Bloom filter per block of rows on a string column. Blocks whose filter rules out
+// the literal of an EQ condition are skipped without a single string comparison.
+class BloomIndex: public Index
+{
+private:
+    std::string column;
+    size_t block_rows;
+    std::vector<BloomFilter> blooms;
+    size_t rows;
+
+public:
+    // Tunables: rows per block, and either a target false positive rate or a fixed
+    // filter size in bytes per block (block_bytes != 0 wins).
+    // Throws std::invalid_argument if header has no such column.
+    BloomIndex(const header_t& header, table_t& table, const std::string& column,
+               size_t block_rows = 1024, double fpp = 0.01, size_t block_bytes = 0)
+    {
+        this->column     = column;
+        this->block_rows = block_rows;
+        this->rows       = table.size();
+
+        size_t bytes = block_bytes ? block_bytes : BloomFilter::bytesFor(block_rows, fpp);
+        int col = columnNumber(header, column);
+        for (size_t begin = 0; begin < table.size(); begin += block_rows)
+        {
+            BloomFilter bloom(bytes);
+            for (size_t i = begin; i < begin + block_rows && i < table.size(); i++)
+            {
+                bloom.add(table[i][col]);
+            }
+            blooms.push_back(bloom);
+        }
+    }
+
+    size_t rowCount() const      { return rows; }
+    size_t blockRows() const     { return block_rows; }
+    size_t bytesPerBlock() const { return blooms.empty() ? 0 : blooms[0].bytes(); }
+
+    // String EQ and IN on the column.
+    bool covers(const ConditionBase& c) const
+    {
+        const Condition<std::string>* cond = dynamic_cast<const Condition<std::string>*>(c.unwrap());
+        return cond && cond->getColumn() == column &&
+               (cond->getOperator() == Operator::EQ || cond->getOperator() == Operator::IN);
+    }
+
+    std::string name() const
+    {
+        return "bloom(" + column + ")";
+    }
+
+    bool filter(const ConditionBase& c, Bitmap& rows) const
+    {
+        if (!covers(c))
+        {
+            return false;
+        }
+
+        // EQ probes its literal, IN probes every listed value.
+        const Condition<std::string>* cond = static_cast<const Condition<std::string>*>(c.unwrap());
+        std::vector<std::string> keys;
+        if (cond->getOperator() == Operator::EQ)
+        {
+            keys.push_back(cond->getValue());
+        }
+        else
+        {
+            keys = static_cast<const InCondition<std::string>*>(cond)->getValues();
+        }
+
+        for (size_t b = 0; b < blooms.size(); b++)
+        {
+            for (size_t k = 0; k < keys.size(); k++)
+            {
+                if (blooms[b].mayContain(keys[k]))
+                {
+                    rows.setRange(b * block_rows, (b + 1) * block_rows);
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+// Inverted index from every 3-byte substring of a column to the rows containing it.
+// Serves LIKE patterns: each literal run of 3+ characters in the pattern must appear in
+// the cell, so the candidates are the intersection of its trigram posting lists.
+class TrigramIndex: public Index
+{
+private:
+    std::string column;
+    std::unordered_map<uint32_t, std::vector<uint32_t> > postings; // sorted row ids
+    size_t rows;
+
+    static uint32_t trigram(const std::string& s, size_t i)
+    {
+        return ((uint32_t)(unsigned char)s[i] << 16) |
+               ((uint32_t)(unsigned char)s[i + 1] << 8) |
+                (uint32_t)(unsigned char)s[i + 2];
+    }
+
+public:
+    // Throws std::invalid_argument if header has no such column.
+    TrigramIndex(const header_t& header, table_t& table, const std::string& column)
+    {
+        this->column = column;
+        this->rows   = table.size();
+
+        int col = columnNumber(header, column);
+        for (size_t row = 0; row < table.size(); row++)
+        {
+            const std::string& cell = table[row][col];
+            for (size_t i = 0; i + 3 <= cell.size(); i++)
+            {
+                std::vector<uint32_t>& list = postings[trigram(cell, i)];
+                // A row repeating a trigram is only listed once.
+                if (list.empty() || list.back() != row)
+                {
+                    list.push_back((uint32_t)row);
+                }
+            }
+        }
+    }
+
+    size_t rowCount() const { return rows; }
+
+    // LIKE on the column with a literal run of 3 or more characters between wildcards.
+    bool covers(const ConditionBase& c) const
+    {
+        const Condition<std::string>* cond = dynamic_cast<const Condition<std::string>*>(c.unwrap());
+        if (!cond || cond->getOperator() != Operator::LIKE || cond->getColumn() != column)
+        {
+            return false;
+        }
+
+        const std::string& pattern = cond->getValue();
+        size_t run = 0;
+        for (size_t i = 0; i < pattern.size(); i++)
+        {
+            run = (pattern[i] == '%' || pattern[i] == '_') ? 0 : run + 1;
+            if (run >= 3)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string name() const
+    {
+        return "trigram(" + column + ")";
+    }
+
+    bool filter(const ConditionBase& c, Bitmap& rows) const
+    {
+        const Condition<std::string>* cond = dynamic_cast<const Condition<std::string>*>(c.unwrap());
+        if (!cond || cond->getOperator() != Operator::LIKE || cond->getColumn() != column)
+        {
+            return false;
+        }
+
+        // Trigrams of the literal runs between wildcards, shortest posting list first.
+        const std::string& pattern = cond->getValue();
+        std::vector<const std::vector<uint32_t>*> lists;
+        size_t begin = 0;
+        for (size_t end = 0; end <= pattern.size(); end++)
+        {
+            if (end < pattern.size() && pattern[end] != '%' && pattern[end] != '_')
+            {
+                continue;
+            }
+            for (size_t i = begin; i + 3 <= end; i++)
+            {
+                std::unordered_map<uint32_t, std::vector<uint32_t> >::const_iterator it =
+                    postings.find(trigram(pattern, i));
+                if (it == postings.end())
+                {
+                    return true; // trigram never seen, nothing can match
+                }
+                lists.push_back(&it->second);
+            }
+            begin = end + 1;
+        }
+        if (lists.empty())
+        {
+            return false; // pattern too short to say anything
+        }
+
+        size_t shortest = 0;
+        for (size_t i = 1; i < lists.size(); i++)
+        {
+            if (lists[i]->size() < lists[shortest]->size()) shortest = i;
+        }
+
+        // Walk the shortest list, probing the others with binary search.
+        const std::vector<uint32_t>& base = *lists[shortest];
+        for (size_t k = 0; k < base.size(); k++)
+        {
+            bool all = true;
+            for (size_t i = 0; i < lists.size() && all; i++)
+            {
+                all = (i == shortest) ||
+                      std::binary_search(lists[i]->begin(), lists[i]->end(), base[k]);
+            }
+            if (all)
+            {
+                rows.set(base[k]);
+            }
+        }
+        return true;
+    }
+};
+
+// Per-column validity bitmaps: a bit is set when the cell is not NULL (not empty).
+// IS NULL / IS NOT NULL are answered from the bitmap alone, and any other comparison
+// skips the NULL rows, since it can only be UNKNOWN there.
+class Validity: public Index
+{
+private:
+    header_t header;
+    std::vector<Bitmap> valid; // by column number
+    size_t rows;
+
+public:
+    Validity(header_t& header, table_t& table)
+    {
+        this->header = header;
+        this->rows   = table.size();
+
+        valid.assign(header.size(), Bitmap(table.size()));
+        for (size_t row = 0; row < table.size(); row++)
+        {
+            for (size_t col = 0; col < table[row].size() && col < valid.size(); col++)
+            {
+                if (!table[row][col].empty())
+                {
+                    valid[col].set(row);
+                }
+            }
+        }
+    }
+
+    size_t rowCount() const { return rows; }
+
+    // Throws std::invalid_argument if the table had no such column.
+    const Bitmap& column(const std::string& name) const
+    {
+        return valid[columnNumber(header, name)];
+    }
+
+    bool filter(const ConditionBase& c, Bitmap& rows) const
+    {
+        header_t::const_iterator it = header.find(c.getColumn());
+        if (it == header.end())
+        {
+            return false;
+        }
+
+        rows |= valid[it->second];
+        if (c.getOperator() == Operator::IS_NULL)
+        {
+            rows.flip();
+        }
+        return true;
+    }
+
+    bool exact(const ConditionBase& c) const
+    {
+        return c.getOperator() == Operator::IS_NULL || c.getOperator() == Operator::IS_NOT_NULL;
+    }
+
+    // Any condition on a known column: only non-NULL rows can satisfy it.
+    bool covers(const ConditionBase& c) const
+    {
+        return header.count(c.getColumn()) != 0;
+    }
+
+    std::string name() const
+    {
+        return "validity";
+    }
+};
+
+// Centered interval tree over closed intervals [lo, hi] tagged with ids. A stabbing query
+// reports every interval containing a value in O(log n + k). Intervals can be added at any
+// time; the tree is rebuilt on the first query after a change.
+class IntervalIndex
+{
+private:
+    struct Interval
+    {
+        double lo;
+        double hi;
+        uint32_t id;
+    };
+
+    struct Node
+    {
+        double center;
+        std::vector<Interval> by_lo; // intervals containing center, ascending lo
+        std::vector<Interval> by_hi; // the same, descending hi
+        int left;                    // intervals entirely below center
+        int right;                   // intervals entirely above center
+    };
+
+    std::vector<Interval> intervals;
+    std::vector<Node> nodes;
+    int root;
+    bool dirty;
+
+    static bool lowerLo(const Interval& a, const Interval& b)  { return a.lo < b.lo; }
+    static bool higherHi(const Interval& a, const Interval& b) { return a.hi > b.hi; }
+
+    int build(std::vector<Interval>& items)
+    {
+        if (items.empty())
+        {
+            return -1;
+        }
+
+        // Center on the median endpoint: add() only takes non-empty intervals, so the endpoint
+        // lies in at least one of them and every level shrinks.
+        std::vector<double> ends;
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            ends.push_back(items[i].lo);
+            ends.push_back(items[i].hi);
+        }
+        std::nth_element(ends.begin(), ends.begin() + ends.size() / 2, ends.end());
+        double center = ends[ends.size() / 2];
+
+        std::vector<Interval> here, below, above;
+        for (size_t i = 0; i < items.size(); i++)
+        {
+            if (items[i].hi < center)      below.push_back(items[i]);
+            else if (items[i].lo > center) above.push_back(items[i]);
+            else                           here.push_back(items[i]);
+        }
+
+        int n = (int)nodes.size();
+        nodes.push_back(Node());
+        nodes[n].center = center;
+        nodes[n].by_lo  = here;
+        nodes[n].by_hi  = here;
+        std::sort(nodes[n].by_lo.begin(), nodes[n].by_lo.end(), lowerLo);
+        std::sort(nodes[n].by_hi.begin(), nodes[n].by_hi.end(), higherHi);
+
+        int left  = build(below);
+        int right = build(above);
+        nodes[n].left  = left;
+        nodes[n].right = right;
+        return n;
+    }
+
+public:
+    IntervalIndex()
+    {
+        root  = -1;
+        dirty = false;
+    }
+
+    // Use +/-INFINITY for open ended ranges. An empty interval (lo > hi, or a NaN bound)
+    // contains no value: it is not added, and false is returned.
+    bool add(double lo, double hi, uint32_t id)
+    {
+        if (!(lo <= hi))
+        {
+            return false;
+        }
+
+        Interval i;
+        i.lo = lo;
+        i.hi = hi;
+        i.id = id;
+        intervals.push_back(i);
+        dirty = true;
+        return true;
+    }
+
+    size_t size() const { return intervals.size(); }
+
+    // Call f(id) for every interval containing v.
+    template <typename F>
+    void stab(double v, F f)
+    {
+        if (dirty)
+        {
+            std::vector<Interval> items(intervals);
+            nodes.clear();
+            root  = build(items);
+            dirty = false;
+        }
+
+        int n = root;
+        while (n >= 0 && !std::isnan(v))
+        {
+            const Node& node = nodes[n];
+            if (v < node.center)
+            {
+                for (size_t i = 0; i < node.by_lo.size() && node.by_lo[i].lo <= v; i++) f(node.by_lo[i].id);
+                n = node.left;
+            }
+            else if (v > node.center)
+            {
+                for (size_t i = 0; i < node.by_hi.size() && node.by_hi[i].hi >= v; i++) f(node.by_hi[i].id);
+                n = node.right;
+            }
+            else
+            {
+                for (size_t i = 0; i < node.by_lo.size(); i++) f(node.by_lo[i].id);
+                break;
+            }
+        }
+    }
+};
+
+// Values satisfying c as a closed interval, if c is a range condition on a T column.
+template <typename T>
+bool rangeOf(const ConditionBase* c, double& lo, double& hi)
+{
+    if (const BetweenCondition<T>* b = dynamic_cast<const BetweenCondition<T>*>(c))
+    {
+        lo = b->getLow();
+        hi = b->getHigh();
+        return true;
+    }
+
+    const Condition<T>* cond = dynamic_cast<const Condition<T>*>(c);
+    if (!cond)
+    {
+        return false;
+    }
+
+    double v = cond->getValue();
+    lo = -INFINITY;
+    hi = INFINITY;
+    switch (cond->getOperator())
+    {
+        case Operator::EQ: lo = hi = v;                         break;
+        case Operator::GT: lo = std::nextafter(v,  INFINITY);  break;
+        case Operator::GE: lo = v;                              break;
+        case Operator::LT: hi = std::nextafter(v, -INFINITY);  break;
+        case Operator::LE: hi = v;                              break;
+        default:           return false;
+    }
+    return true;
+}
+
+// Matches one row against many registered clauses at once and returns the ids of the clauses
+// it satisfies. Every AND group of every clause is indexed by its equality conditions
+// (EQ and IN on string or int columns), or failing that by its numeric ranges (<, <=, >, >=,
+// BETWEEN, float EQ): a row looks up its cells in per-column value maps and interval trees
+// and counts, per group, how many of those conditions it satisfied. Only groups whose count
+// is complete get their remaining conditions evaluated, so the cost follows the number of
+// candidate matches rather than the number of clauses. Ranges are rarely selective, so they
+// are only indexed for groups without an equality. Groups without any indexed condition
+// are evaluated for every row.
+class MatchEngine
+{
+private:
+    struct Group
+    {
+        size_t clause;
+        uint32_t indexed;                    // indexed conditions to be counted
+        std::vector<ConditionBase*> residual; // evaluated once the count is complete
+    };
+
+    typedef std::unordered_map<std::string, std::vector<uint32_t> > string_postings_t;
+    typedef std::unordered_map<int, std::vector<uint32_t> >         int_postings_t;
+
+    std::vector<Where*> clauses; // owned
+    std::vector<Group>  groups;
+    std::map<std::string, string_postings_t> string_equals; // column -> value -> groups
+    std::map<std::string, int_postings_t>    int_equals;
+    std::map<std::string, IntervalIndex>     int_ranges;   // column -> ranges of groups
+    std::map<std::string, IntervalIndex>     float_ranges;
+    std::vector<uint32_t> unanchored; // groups with nothing to count
+
+    std::vector<uint32_t> hits;    // per group, only nonzero while matching a row
+    std::vector<uint32_t> touched; // groups with hits
+
+    // Index c for group g if it is an equality condition.
+    bool indexEquality(const ConditionBase* c, uint32_t g)
+    {
+        c = c->unwrap();
+        if (const Condition<std::string>* cs = dynamic_cast<const Condition<std::string>*>(c))
+        {
+            if (c->getOperator() == Operator::EQ)
+            {
+                string_equals[c->getColumn()][cs->getValue()].push_back(g);
+                return true;
+            }
+            if (c->getOperator() == Operator::IN)
+            {
+                const std::vector<std::string>& values = static_cast<const InCondition<std::string>*>(c)->getValues();
+                for (size_t i = 0; i < values.size(); i++)
+                {
+                    string_equals[c->getColumn()][values[i]].push_back(g);
+                }
+                return true;
+            }
+        }
+        if (const Condition<int>* ci = dynamic_cast<const Condition<int>*>(c))
+        {
+            if (c->getOperator() == Operator::EQ)
+            {
+                int_equals[c->getColumn()][ci->getValue()].push_back(g);
+                return true;
+            }
+            if (c->getOperator() == Operator::IN)
+            {
+                const std::vector<int>& values = static_cast<const InCondition<int>*>(c)->getValues();
+                for (size_t i = 0; i < values.size(); i++)
+                {
+                    int_equals[c->getColumn()][values[i]].push_back(g);
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Index c for group g if it is a numeric range condition.
+    bool indexRange(const ConditionBase* c, uint32_t g)
+    {
+        c = c->unwrap();
+
+        double lo, hi;
+        if (rangeOf<int>(c, lo, hi))
+        {
+            return int_ranges[c->getColumn()].add(lo, hi, g);
+        }
+        if (rangeOf<float>(c, lo, hi))
+        {
+            return float_ranges[c->getColumn()].add(lo, hi, g);
+        }
+        return false;
+    }
+
+    // True if c is a range no value lies in, i.e. age BETWEEN 61 AND 29.
+    static bool emptyRange(const ConditionBase* c)
+    {
+        c = c->unwrap();
+
+        double lo, hi;
+        return (rangeOf<int>(c, lo, hi) || rangeOf<float>(c, lo, hi)) && !(lo <= hi);
+    }
+
+    void hit(uint32_t g)
+    {
+        if (hits[g]++ == 0)
+        {
+            touched.push_back(g);
+        }
+    }
+
+    void hit(const std::vector<uint32_t>& list)
+    {
+        for (size_t i = 0; i < list.size(); i++)
+        {
+            hit(list[i]);
+        }
+    }
+
+    template <typename T>
+    void hitRanges(std::map<std::string, IntervalIndex>& ranges, header_t& header, row_t& row)
+    {
+        for (std::map<std::string, IntervalIndex>::iterator col = ranges.begin(); col != ranges.end(); ++col)
+        {
+            T val;
+            const std::string* cell = findCell(header, row, col->first);
+            if (cell && parseCell(*cell, val))
+            {
+                col->second.stab((double)val, [this](uint32_t g) { hit(g); });
+            }
+        }
+    }
+
+    bool residualPasses(const Group& group, header_t& header, row_t& row)
+    {
+        for (size_t i = 0; i < group.residual.size(); i++)
+        {
+            if (!group.residual[i]->eval(header, row))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    ~MatchEngine()
+    {
+        for (size_t i = 0; i < clauses.size(); i++)
+        {
+            delete clauses[i];
+        }
+    }
+
+    // Register a clause, the engine takes ownership. Returns the clause id.
+    size_t AddClause(Where* where)
+    {
+        size_t id = clauses.size();
+        clauses.push_back(where);
+
+        std::vector<std::vector<ConditionBase*> > conjunctions = where->groups();
+        for (size_t i = 0; i < conjunctions.size(); i++)
+        {
+            // A group holding an empty range can never match, leave it out.
+            bool never = false;
+            for (size_t j = 0; j < conjunctions[i].size(); j++)
+            {
+                never |= emptyRange(conjunctions[i][j]);
+            }
+            if (never)
+            {
+                continue;
+            }
+
+            uint32_t g = (uint32_t)groups.size();
+            groups.push_back(Group());
+            groups[g].clause  = id;
+            groups[g].indexed = 0;
+
+            std::vector<ConditionBase*> others;
+            for (size_t j = 0; j < conjunctions[i].size(); j++)
+            {
+                if (indexEquality(conjunctions[i][j], g))
+                {
+                    groups[g].indexed++;
+                }
+                else
+                {
+                    others.push_back(conjunctions[i][j]);
+                }
+            }
+            bool by_range = (groups[g].indexed == 0);
+            for (size_t j = 0; j < others.size(); j++)
+            {
+                if (by_range && indexRange(others[j], g))
+                {
+                    groups[g].indexed++;
+                }
+                else
+                {
+                    groups[g].residual.push_back(others[j]);
+                }
+            }
+            if (groups[g].indexed == 0)
+            {
+                unanchored.push_back(g);
+            }
+        }
+        hits.resize(groups.size(), 0);
+
+        return id;
+    }
+
+    size_t size() const { return clauses.size(); }
+
+    // Ids of all clauses the row satisfies, ascending.
+    std::vector<size_t> match(header_t& header, row_t& row)
+    {
+        touched.clear();
+
+        for (std::map<std::string, string_postings_t>::iterator col = string_equals.begin(); col != string_equals.end(); ++col)
+        {
+            const std::string* cell = findCell(header, row, col->first);
+            string_postings_t::iterator it = !cell || cell->empty() ? col->second.end() : col->second.find(*cell);
+            if (it != col->second.end())
+            {
+                hit(it->second);
+            }
+        }
+        for (std::map<std::string, int_postings_t>::iterator col = int_equals.begin(); col != int_equals.end(); ++col)
+        {
+            int val;
+            const std::string* cell = findCell(header, row, col->first);
+            if (cell && parseCell(*cell, val))
+            {
+                int_postings_t::iterator it = col->second.find(val);
+                if (it != col->second.end())
+                {
+                    hit(it->second);
+                }
+            }
+        }
+        hitRanges<int>(int_ranges, header, row);
+        hitRanges<float>(float_ranges, header, row);
+
+        std::vector<size_t> result;
+        for (size_t i = 0; i < touched.size(); i++)
+        {
+            const Group& group = groups[touched[i]];
+            if (hits[touched[i]] == group.indexed && residualPasses(group, header, row))
+            {
+                result.push_back(group.clause);
+            }
+            hits[touched[i]] = 0;
+        }
+        for (size_t i = 0; i < unanchored.size(); i++)
+        {
+            const Group& group = groups[unanchored[i]];
+            if (residualPasses(group, header, row))
+            {
+                result.push_back(group.clause);
+            }
+        }
+
+        // A clause matched by several groups is reported once.
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+};
+
+// Keeps the set of rows satisfying a clause up to date while the table changes.
+// The result of every condition is stored per row, so an update only re-evaluates the
+// conditions reading a changed column, and the clause is recombined from stored results.
+// Changes must go through this class, and the clause must outlive it. The filter runs
+// its own plan of the clause (Where::Plan()), so the clause itself is left as built.
+// Registries behind shared conditions are Reset() before every evaluation, so a changed
+// row is never answered from a result remembered for its old values.
+class MaterializedFilter
+{
+private:
+    header_t& header;
+    table_t&  table;
+    std::unique_ptr<Where> plan;                      // of the clause, owns fused conditions
+    std::vector<std::vector<ConditionBase*> > groups; // the plan, as an OR of AND groups
+    std::vector<ConditionBase*> conditions;           // flattened groups
+    std::map<std::string, std::vector<size_t> > readers; // column -> conditions reading it
+    std::vector<ConditionRegistry*> registries;          // behind shared conditions
+
+    std::vector<std::vector<char> > results; // row -> condition -> passed
+    std::vector<char> matching;              // row -> clause passed
+    size_t matched;
+    size_t evaluations;
+
+    void evalCondition(size_t row, size_t c)
+    {
+        results[row][c] = conditions[c]->eval(header, table[row]);
+        evaluations++;
+    }
+
+    // Recombine the clause for row from the stored condition results.
+    void combine(size_t row)
+    {
+        bool pass = false;
+        for (size_t g = 0, c = 0; g < groups.size(); g++)
+        {
+            bool all = true;
+            for (size_t j = 0; j < groups[g].size(); j++, c++)
+            {
+                all = all && results[row][c];
+            }
+            pass = pass || all;
+        }
+
+        if (pass != (matching[row] != 0))
+        {
+            pass ? matched++ : matched--;
+        }
+        matching[row] = pass;
+    }
+
+    // Drop results shared conditions remember, they may belong to the row's old values.
+    void forget()
+    {
+        for (size_t i = 0; i < registries.size(); i++)
+        {
+            registries[i]->Reset();
+        }
+    }
+
+    void checkCell(size_t row, size_t col) const
+    {
+        if (row >= table.size())
+        {
+            throw std::out_of_range("row " + std::to_string(row) + " of " + std::to_string(table.size()));
+        }
+        if (col >= table[row].size())
+        {
+            throw std::out_of_range("cell " + std::to_string(col) + " of a row of " + std::to_string(table[row].size()));
+        }
+    }
+
+    void evalRow(size_t row)
+    {
+        forget();
+        for (size_t c = 0; c < conditions.size(); c++)
+        {
+            evalCondition(row, c);
+        }
+        combine(row);
+    }
+
+public:
+    MaterializedFilter(header_t& header, table_t& table, Where& where)
+        : header(header), table(table)
+    {
+        plan   = where.Plan();
+        groups = plan->groups();
+        for (size_t g = 0; g < groups.size(); g++)
+        {
+            for (size_t j = 0; j < groups[g].size(); j++)
+            {
+                readers[groups[g][j]->getColumn()].push_back(conditions.size());
+                conditions.push_back(groups[g][j]);
+
+                SharedCondition* shared = dynamic_cast<SharedCondition*>(groups[g][j]);
+                if (shared && std::find(registries.begin(), registries.end(), &shared->getRegistry()) == registries.end())
+                {
+                    registries.push_back(&shared->getRegistry());
+                }
+            }
+        }
+
+        matched     = 0;
+        evaluations = 0;
+        results.assign(table.size(), std::vector<char>(conditions.size(), 0));
+        matching.assign(table.size(), 0);
+        for (size_t row = 0; row < table.size(); row++)
+        {
+            evalRow(row);
+        }
+    }
+
+    void insert(const row_t& row)
+    {
+        table.push_back(row);
+        results.push_back(std::vector<char>(conditions.size(), 0));
+        matching.push_back(0);
+        evalRow(table.size() - 1);
+    }
+
+    // Change one cell; only the conditions on that column are evaluated again.
+    // Throws std::invalid_argument for an unknown column, std::out_of_range for a row
+    // past the table or a cell past the row; nothing is changed then.
+    void update(size_t row, const std::string& column, const std::string& value)
+    {
+        size_t col = (size_t)columnNumber(header, column);
+        checkCell(row, col);
+        table[row][col] = value;
+
+        std::map<std::string, std::vector<size_t> >::iterator it = readers.find(column);
+        if (it == readers.end())
+        {
+            return; // the clause does not read this column
+        }
+        forget();
+        for (size_t i = 0; i < it->second.size(); i++)
+        {
+            evalCondition(row, it->second[i]);
+        }
+        combine(row);
+    }
+
+    // Replace a whole row; only the conditions on columns that differ are evaluated again.
+    // Throws like the above, or std::invalid_argument if values is too short for the header,
+    // before anything is changed.
+    void update(size_t row, const row_t& values)
+    {
+        for (header_t::iterator col = header.begin(); col != header.end(); ++col)
+        {
+            checkCell(row, col->second);
+            if ((size_t)col->second >= values.size())
+            {
+                throw std::invalid_argument("row of " + std::to_string(values.size()) +
+                                            " cells has no column \"" + col->first + "\"");
+            }
+        }
+        for (header_t::iterator col = header.begin(); col != header.end(); ++col)
+        {
+            if (table[row][col->second] != values[col->second])
+            {
+                update(row, col->first, values[col->second]);
+            }
+        }
+    }
+
+    // Remove a row; later rows move up by one, as in the table.
+    void erase(size_t row)
+    {
+        matched -= matching[row];
+        table.erase(table.begin() + row);
+        results.erase(results.begin() + row);
+        matching.erase(matching.begin() + row);
+    }
+
+    bool matches(size_t row) const { return matching[row] != 0; }
+    size_t count() const           { return matched; }
+    size_t evaluated() const       { return evaluations; } // condition evaluations so far
+
+    // Ids of the matching rows, in table order.
+    std::vector<size_t> rows() const
+    {
+        std::vector<size_t> ids;
+        for (size_t i = 0; i < matching.size(); i++)
+        {
+            if (matching[i]) ids.push_back(i);
+        }
+        return ids;
+    }
+};
+
+// Sorted row ids, stored as varint encoded gaps: a dense result costs about a byte per row.
+class RowSet
+{
+private:
+    std::vector<uint8_t> bytes;
+    size_t rows;
+
+public:
+    RowSet(const std::vector<size_t>& ids = std::vector<size_t>())
+    {
+        rows = ids.size();
+
+        size_t last = 0;
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            size_t gap = ids[i] - last;
+            last = ids[i];
+            while (gap >= 0x80)
+            {
+                bytes.push_back((uint8_t)(gap | 0x80));
+                gap >>= 7;
+            }
+            bytes.push_back((uint8_t)gap);
+        }
+    }
+
+    size_t size() const      { return rows; }
+    size_t byteSize() const  { return bytes.size(); }
+
+    std::vector<size_t> decode() const
+    {
+        std::vector<size_t> ids;
+        ids.reserve(rows);
+
+        size_t last = 0;
+        for (size_t i = 0; i < bytes.size(); )
+        {
+            size_t gap = 0;
+            int shift = 0;
+            while (bytes[i] & 0x80)
+            {
+                gap |= (size_t)(bytes[i++] & 0x7f) << shift;
+                shift += 7;
+            }
+            gap |= (size_t)bytes[i++] << shift;
+            last += gap;
+            ids.push_back(last);
+        }
+        return ids;
+    }
+};
+
+// Caches clause results for a table. Entries are keyed by the clause fingerprint and tagged
+// with the table version they were computed on; the caller bumps the version whenever the
+// table changes, and results of older versions are dropped as soon as a newer one is seen.
+// Least recently used entries are evicted to stay within a byte budget.
+class ResultCache
+{
+private:
+    struct Entry
+    {
+        std::string fingerprint;
+        uint64_t    version;
+        RowSet      rows;
+    };
+
+    typedef std::list<Entry> lru_t; // most recently used first
+
+    lru_t lru;
+    std::unordered_map<std::string, lru_t::iterator> index;
+    size_t budget;
+    size_t used;
+    uint64_t current; // newest table version seen
+    size_t hits;
+    size_t misses;
+
+    static size_t cost(const Entry& e)
+    {
+        return sizeof(Entry) + 2 * e.fingerprint.size() + e.rows.byteSize();
+    }
+
+    void drop(lru_t::iterator it)
+    {
+        used -= cost(*it);
+        index.erase(it->fingerprint);
+        lru.erase(it);
+    }
+
+    // A newer table version makes every older result stale.
+    void observe(uint64_t version)
+    {
+        if (version > current)
+        {
+            current = version;
+            invalidate(version);
+        }
+    }
+
+public:
+    ResultCache(size_t budget_bytes = 64 << 20)
+    {
+        budget  = budget_bytes;
+        used    = 0;
+        current = 0;
+        hits    = 0;
+        misses  = 0;
+    }
+
+    // Cached rows of where on the given table version, if any.
+    bool get(const Where& where, uint64_t version, std::vector<size_t>& rows)
+    {
+        observe(version);
+
+        std::unordered_map<std::string, lru_t::iterator>::iterator it = index.find(where.fingerprint());
+        if (it == index.end() || it->second->version != version)
+        {
+            misses++;
+            return false;
+        }
+
+        lru.splice(lru.begin(), lru, it->second);
+        rows = it->second->rows.decode();
+        hits++;
+        return true;
+    }
+
+    // Like get(), but only the number of cached rows; nothing is decoded.
+    bool count(const Where& where, uint64_t version, size_t& rows)
+    {
+        observe(version);
+
+        std::unordered_map<std::string, lru_t::iterator>::iterator it = index.find(where.fingerprint());
+        if (it == index.end() || it->second->version != version)
+        {
+            misses++;
+            return false;
+        }
+
+        lru.splice(lru.begin(), lru, it->second);
+        rows = it->second->rows.size();
+        hits++;
+        return true;
+    }
+
+    void put(const Where& where, uint64_t version, const std::vector<size_t>& rows)
+    {
+        observe(version);
+        if (version < current)
+        {
+            return; // already stale
+        }
+
+        Entry e;
+        e.fingerprint = where.fingerprint();
+        e.version     = version;
+        e.rows        = RowSet(rows);
+        if (cost(e) > budget)
+        {
+            return;
+        }
+
+        std::unordered_map<std::string, lru_t::iterator>::iterator it = index.find(e.fingerprint);
+        if (it != index.end())
+        {
+            drop(it->second);
+        }
+        while (used + cost(e) > budget)
+        {
+            drop(--lru.end());
+        }
+
+        used += cost(e);
+        lru.push_front(e);
+        index[e.fingerprint] = lru.begin();
+    }
+
+    // Drop every result computed on a version older than version.
+    void invalidate(uint64_t version)
+    {
+        for (lru_t::iterator it = lru.begin(); it != lru.end(); )
+        {
+            lru_t::iterator next = it;
+            ++next;
+            if (it->version < version)
+            {
+                drop(it);
+            }
+            it = next;
+        }
+    }
+
+    size_t size() const     { return lru.size(); }
+    size_t byteSize() const { return used; }
+    size_t hitCount() const  { return hits; }
+    size_t missCount() const { return misses; }
+};
+
+// Scan driver: runs a Where clause over a table, only visiting rows the indexes can't rule out.
+class Scan
+{
+private:
+    static const size_t MORSEL = 16384; // rows per unit of parallel work
+
+    header_t& header;
+    table_t&  table;
+    Where&    where;
+    std::vector<Index*> indexes; // not owned, an index may serve many scans
+    ResultCache* cache;          // not owned
+    uint64_t version;
+    size_t limit;                // 0 = no limit
+    size_t threads;
+    std::vector<std::string> columns; // projection, empty = all columns
+
+    // Append the matches among the candidate rows in [begin, end) to out, up to limit.
+    // Returns false if stop was raised before the range was done.
+    bool scanRange(Where& plan, const Bitmap& rows, const Bitmap& sure, size_t begin, size_t end,
+                   std::vector<size_t>& out, const std::atomic<bool>* stop)
+    {
+        for (size_t i = rows.next(begin); i < end; i = rows.next(i + 1))
+        {
+            if (stop && stop->load(std::memory_order_relaxed))
+            {
+                return false;
+            }
+            if (sure.test(i) || plan.eval(header, table[i]))
+            {
+                out.push_back(i);
+                if (limit && out.size() == limit)
+                {
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Morsel driven parallel scan. Results keep table order: morsel results are only
+    // concatenated as a gapless prefix, and once that prefix holds limit matches the
+    // remaining morsels are cancelled, including those already running.
+    std::vector<size_t> scanParallel(Where& plan, const Bitmap& rows, const Bitmap& sure)
+    {
+        size_t morsels = (rows.size() + MORSEL - 1) / MORSEL;
+        std::vector<std::vector<size_t> > results(morsels);
+        std::vector<char> done(morsels, 0);
+        std::atomic<size_t> next(0);
+        std::atomic<bool> stop(false);
+        std::mutex lock;
+        size_t prefix = 0;         // morsels 0 .. prefix-1 are done
+        size_t prefix_matches = 0;
+
+        auto worker = [&]()
+        {
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                size_t m = next++;
+                if (m >= morsels)
+                {
+                    return;
+                }
+
+                std::vector<size_t> found;
+                size_t end = std::min((m + 1) * MORSEL, rows.size());
+                if (!scanRange(plan, rows, sure, m * MORSEL, end, found, &stop))
+                {
+                    return; // cancelled, only morsels after the prefix get here
+                }
+
+                std::lock_guard<std::mutex> guard(lock);
+                results[m].swap(found);
+                done[m] = 1;
+                while (prefix < morsels && done[prefix])
+                {
+                    prefix_matches += results[prefix++].size();
+                }
+                if (limit && prefix_matches >= limit)
+                {
+                    stop = true;
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < threads; t++)
+        {
+            pool.push_back(std::thread(worker));
+        }
+        worker();
+        for (size_t t = 0; t < pool.size(); t++)
+        {
+            pool[t].join();
+        }
+
+        std::vector<size_t> matches;
+        for (size_t m = 0; m < prefix && (!limit || matches.size() < limit); m++)
+        {
+            matches.insert(matches.end(), results[m].begin(), results[m].end());
+        }
+        if (limit && matches.size() > limit)
+        {
+            matches.resize(limit);
+        }
+        return matches;
+    }
+
+    // Set the bit of every row in [begin, end) of rows that passes the clause.
+    void selectRange(Where& plan, const Bitmap& rows, size_t begin, size_t end, Bitmap& selected)
+    {
+        for (size_t i = rows.next(begin); i < end; i = rows.next(i + 1))
+        {
+            if (plan.eval(header, table[i]))
+            {
+                selected.set(i);
+            }
+        }
+    }
+
+    // Parallel selectRange over morsels. A morsel is a whole number of bitmap words,
+    // so threads never write to the same word.
+    void selectParallel(Where& plan, const Bitmap& rows, Bitmap& selected)
+    {
+        size_t morsels = (rows.size() + MORSEL - 1) / MORSEL;
+        std::atomic<size_t> next(0);
+
+        auto worker = [&]()
+        {
+            for (size_t m = next++; m < morsels; m = next++)
+            {
+                selectRange(plan, rows, m * MORSEL, std::min((m + 1) * MORSEL, rows.size()), selected);
+            }
+        };
+
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < threads; t++)
+        {
+            pool.push_back(std::thread(worker));
+        }
+        worker();
+        for (size_t t = 0; t < pool.size(); t++)
+        {
+            pool[t].join();
+        }
+    }
+
+public:
+    Scan(header_t& header, table_t& table, Where& where)
+        : header(header), table(table), where(where)
+    {
+        cache   = NULL;
+        version = 0;
+        limit   = 0;
+        threads = 1;
+    }
+
+    // An index built before rows were appended to the table is ignored until rebuilt.
+    Scan* AddIndex(Index* index)
+    {
+        indexes.push_back(index);
+        return this;
+    }
+
+    // Serve results from cache when the table is still at the given version.
+    Scan* SetCache(ResultCache* cache, uint64_t version)
+    {
+        this->cache   = cache;
+        this->version = version;
+        return this;
+    }
+
+    // Add a column to the projection, in output order. Without any, select() returns all columns.
+    Scan* AddColumn(const std::string& column)
+    {
+        columns.push_back(column);
+        return this;
+    }
+
+    // LIMIT k: stop as soon as the first k matches (in table order) are known. 0 = no limit.
+    Scan* SetLimit(size_t limit)
+    {
+        this->limit = limit;
+        return this;
+    }
+
+    // Scan with this many threads. Conditions are then evaluated concurrently, which
+    // every condition supports except those shared through a ConditionRegistry.
+    Scan* SetThreads(size_t threads)
+    {
+        this->threads = threads ? threads : 1;
+        return this;
+    }
+
+    // EXPLAIN: how run(), select() and count() would go about the clause, without running
+    // them. The clause is shown as planned, i.e. with range pairs fused.
+    std::string explain()
+    {
+        std::unique_ptr<Where> plan = where.Plan();
+        std::ostringstream s;
+        // Indexes of another table size are skipped by candidates(), leave them out here too.
+        std::vector<Index*> current;
+        for (size_t i = 0; i < indexes.size(); i++)
+        {
+            if (indexes[i]->rowCount() == table.size())
+            {
+                current.push_back(indexes[i]);
+            }
+        }
+
+        s << plan->explain(current)
+          << "access: " << plan->accessPath(current) << '\n'
+          << "scan: " << table.size() << " rows";
+        if (threads > 1 && table.size() > MORSEL)
+        {
+            s << ", " << threads << " threads over morsels of " << MORSEL << " rows";
+        }
+        else
+        {
+            s << ", 1 thread";
+        }
+        if (limit)
+        {
+            s << ", stop after " << limit << " matches";
+        }
+        if (cache)
+        {
+            s << ", result cache at version " << version << " checked first";
+        }
+        s << '\n' << "select: ";
+        if (columns.empty())
+        {
+            s << "all columns";
+        }
+        for (size_t i = 0; i < columns.size(); i++)
+        {
+            s << (i ? ", " : "") << columns[i];
+        }
+        s << ", copied after filtering\n";
+        return s.str();
+    }
+
+    // Ids of the matching rows, in table order.
+    std::vector<size_t> run()
+    {
+        std::unique_ptr<Where> plan = where.Plan();
+        std::vector<size_t> matches;
+        if (cache && cache->get(*plan, version, matches))
+        {
+            if (limit && matches.size() > limit)
+            {
+                matches.resize(limit);
+            }
+            return matches;
+        }
+
+        Bitmap sure;
+        Bitmap rows = plan->candidates(indexes, table.size(), &sure);
+        if (threads > 1 && rows.size() > MORSEL)
+        {
+            matches = scanParallel(*plan, rows, sure);
+        }
+        else
+        {
+            scanRange(*plan, rows, sure, 0, rows.size(), matches, NULL);
+        }
+
+        // A limited result is not the whole answer, keep it out of the cache.
+        if (cache && !limit)
+        {
+            cache->put(*plan, version, matches);
+        }
+        return matches;
+    }
+
+    // SELECT columns: filter first, then copy only the projected cells of the matching rows
+    // (late materialization), so wide rows that fail the clause are never copied.
+    // Throws std::invalid_argument, before scanning, if a projected column is unknown.
+    table_t select()
+    {
+        std::vector<int> cols;
+        for (size_t i = 0; i < columns.size(); i++)
+        {
+            cols.push_back(columnNumber(header, columns[i]));
+        }
+        if (cols.empty())
+        {
+            for (size_t i = 0; i < header.size(); i++)
+            {
+                cols.push_back((int)i);
+            }
+        }
+
+        std::vector<size_t> rows = run();
+        table_t result(rows.size(), row_t(cols.size()));
+        for (size_t r = 0; r < rows.size(); r++)
+        {
+            const row_t& row = table[rows[r]];
+            for (size_t c = 0; c < cols.size(); c++)
+            {
+                result[r][c] = row[cols[c]];
+            }
+        }
+        return result;
+    }
+
+    // SELECT COUNT(*): the number of matching rows, without materializing their ids.
+    // Matches are collected in a bitmap and counted with popcount. Rows that exact indexes
+    // prove are counted without touching the table, so a clause the indexes answer
+    // completely (i.e. IS NULL with a Validity index) never reads a row. With a LIMIT the
+    // count stops at limit matches, as run() does.
+    size_t count()
+    {
+        // With a LIMIT, run() stops at the first limit matches; counting them is enough.
+        if (limit)
+        {
+            return run().size();
+        }
+
+        std::unique_ptr<Where> plan = where.Plan();
+        size_t n;
+        if (cache && cache->count(*plan, version, n))
+        {
+            return n;
+        }
+
+        Bitmap selected;
+        Bitmap rows = plan->candidates(indexes, table.size(), &selected);
+        rows.subtract(selected);
+        if (threads > 1 && rows.size() > MORSEL)
+        {
+            selectParallel(*plan, rows, selected);
+        }
+        else
+        {
+            selectRange(*plan, rows, 0, rows.size(), selected);
+        }
+
+        return selected.count();
+    }
+};
+
+// Column of a ColumnFile, read in place from the mapped file.
+class MappedColumn: public Column
+{
+private:
+    int            kind;
+    size_t         rows;
+    const uint64_t* validity; // bit set when the cell is not NULL
+    const int32_t* ints;      // INT
+    const float*   floats;    // FLOAT
+    const uint64_t* offsets;  // STRING: cell i is blob[offsets[i], offsets[i + 1])
+    const char*    blob;
+
+    std::string text(size_t row) const
+    {
+        return std::string(blob + offsets[row], offsets[row + 1] - offsets[row]);
+    }
+
+public:
+    MappedColumn(int kind, size_t rows, const uint64_t* validity, const void* data, const char* blob)
+    {
+        this->kind     = kind;
+        this->rows     = rows;
+        this->validity = validity;
+        this->ints     = (const int32_t*)data;
+        this->floats   = (const float*)data;
+        this->offsets  = (const uint64_t*)data;
+        this->blob     = blob;
+    }
+
+    int type() const    { return kind; }
+    size_t size() const { return rows; }
+
+    bool isNull(size_t row) const
+    {
+        return !((validity[row >> 6] >> (row & 63)) & 1);
+    }
+
+    bool get(size_t row, int& val) const
+    {
+        if (isNull(row))
+        {
+            return false;
+        }
+        if (kind == INT)
+        {
+            val = ints[row];
+            return true;
+        }
+        if (kind == FLOAT)
+        {
+            // strtol stops at the '.', so the integer part; NaN and out of range fail.
+            float f = floats[row];
+            if (!(f > -2147483649.0f && f < 2147483648.0f))
+            {
+                return false;
+            }
+            val = (int)f;
+            return true;
+        }
+        return parseCell(text(row), val);
+    }
+
+    bool get(size_t row, float& val) const
+    {
+        if (isNull(row))
+        {
+            return false;
+        }
+        if (kind == INT)
+        {
+            val = (float)ints[row];
+            return true;
+        }
+        if (kind == FLOAT)
+        {
+            val = floats[row];
+            return true;
+        }
+        return parseCell(text(row), val);
+    }
+
+    // 64 rows per step: a compare per row, no branches, so the compiler can vectorize it.
+    bool selectRange(long long lo, long long hi, size_t begin, const Bitmap& rows, Bitmap& out) const
+    {
+        if (kind != INT || begin % 64)
+        {
+            return false;
+        }
+        if (lo > hi)
+        {
+            return true;
+        }
+        unsigned long long span = (unsigned long long)(hi - lo);
+        size_t first = begin / 64;
+        for (size_t w = 0; w * 64 < rows.size(); w++)
+        {
+            uint64_t live = rows.word(w) & validity[first + w];
+            if (!live)
+            {
+                continue;
+            }
+            const int32_t* block = ints + (first + w) * 64;
+            size_t n = std::min((size_t)64, this->rows - (first + w) * 64);
+            uint64_t hit = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                hit |= (uint64_t)((unsigned long long)(block[i] - lo) <= span) << i;
+            }
+            out.setWord(w, out.word(w) | (hit & live));
+        }
+        return true;
+    }
+
+    bool get(size_t row, std::string& val) const
+    {
+        if (isNull(row))
+        {
+            return false;
+        }
+        if (kind == INT)
+        {
+            val = std::to_string(ints[row]);
+        }
+        else if (kind == FLOAT)
+        {
+            val = formatFloat(floats[row]);
+        }
+        else
+        {
+            val.assign(blob + offsets[row], offsets[row + 1] - offsets[row]);
+        }
+        return true;
+    }
+};
+
+// INT column of a ColumnFile stored frame of reference + bit packed: every value is kept
+// as value - base in width bits, so an age column takes 6 bits a row instead of 32.
+// Rows are packed in blocks of 64, and a block takes exactly width words.
+class PackedColumn: public Column
+{
+private:
+    size_t          rows;
+    const uint64_t* validity;
+    const uint64_t* words;    // with spare words at the end, so unpacking may read past
+    long long       base;
+    unsigned        width;    // 0 .. 31
+    uint64_t        mask;
+
+    // Encoded value of the row-th row of the block starting at p.
+    uint64_t code(const uint64_t* p, size_t i) const
+    {
+        size_t bit = i * width;
+        size_t off = bit & 63;
+        p += bit >> 6;
+        return ((p[0] >> off) | ((p[1] << 1) << (63 - off))) & mask;
+    }
+
+public:
+    PackedColumn(size_t rows, const uint64_t* validity, const uint64_t* words, long long base, unsigned width)
+    {
+        this->rows     = rows;
+        this->validity = validity;
+        this->words    = words;
+        this->base     = base;
+        this->width    = width;
+        this->mask     = (1ULL << width) - 1;
+    }
+
+    int type() const    { return INT; }
+    size_t size() const { return rows; }
+
+    bool isNull(size_t row) const
+    {
+        return !((validity[row >> 6] >> (row & 63)) & 1);
+    }
+
+    bool get(size_t row, int& val) const
+    {
+        if (isNull(row))
+        {
+            return false;
+        }
+        val = (int)(base + (long long)code(words, row));
+        return true;
+    }
+
+    bool get(size_t row, float& val) const
+    {
+        int i;
+        if (!get(row, i))
+        {
+            return false;
+        }
+        val = (float)i;
+        return true;
+    }
+
+    bool get(size_t row, std::string& val) const
+    {
+        int i;
+        if (!get(row, i))
+        {
+            return false;
+        }
+        val = std::to_string(i);
+        return true;
+    }
+
+    // The range is moved into the encoded domain once, then every block of 64 rows is
+    // unpacked and compared with one unsigned compare per value, without decoding.
+    bool selectRange(long long lo, long long hi, size_t begin, const Bitmap& rows, Bitmap& out) const
+    {
+        if (begin % 64)
+        {
+            return false;
+        }
+        lo = std::max(lo - base, 0LL);
+        hi = std::min(hi - base, (long long)mask);
+        if (lo > hi)
+        {
+            return true;
+        }
+        uint64_t low  = (uint64_t)lo;
+        uint64_t span = (uint64_t)(hi - lo);
+        size_t first = begin / 64;
+        for (size_t w = 0; w * 64 < rows.size(); w++)
+        {
+            uint64_t live = rows.word(w) & validity[first + w];
+            if (!live)
+            {
+                continue;
+            }
+            const uint64_t* block = words + (first + w) * width;
+            uint64_t hit = 0;
+            for (size_t i = 0; i < 64; i++)
+            {
+                hit |= (uint64_t)(code(block, i) - low <= span) << i;
+            }
+            out.setWord(w, out.word(w) | (hit & live));
+        }
+        return true;
+    }
+};
+
+// Run length encoded column of a ColumnFile: one value per run of equal cells, stored as
+// a column of its own, and the row where each run ends. Sorted or clustered columns turn
+// into a handful of runs, which conditions evaluate once each (see ConditionBase::select).
+class RleColumn: public Column
+{
+private:
+    size_t          rows;
+    size_t          runs;
+    const uint64_t* ends;   // ends[i]: first row after run i, ascending, ends[runs - 1] == rows
+    Column*         values; // owned, runs rows
+
+    size_t runOf(size_t row) const
+    {
+        return std::upper_bound(ends, ends + runs, (uint64_t)row) - ends;
+    }
+
+public:
+    RleColumn(size_t rows, size_t runs, const uint64_t* ends, Column* values)
+    {
+        this->rows   = rows;
+        this->runs   = runs;
+        this->ends   = ends;
+        this->values = values;
+    }
+
+    ~RleColumn()
+    {
+        delete values;
+    }
+
+    int type() const    { return values->type(); }
+    size_t size() const { return rows; }
+
+    bool isNull(size_t row) const                   { return values->isNull(runOf(row)); }
+    bool get(size_t row, int& val) const            { return values->get(runOf(row), val); }
+    bool get(size_t row, float& val) const          { return values->get(runOf(row), val); }
+    bool get(size_t row, std::string& val) const    { return values->get(runOf(row), val); }
+
+    const Column* runValues() const { return values; }
+    size_t runEnd(size_t i) const   { return (size_t)ends[i]; }
+};
+
+// Per-column statistics kept in the footer of a ColumnFile.
+struct ColumnStats
+{
+    size_t nulls;
+    double min; // smallest / largest non-NULL value of an INT or FLOAT column,
+    double max; // NaN for strings and for columns that are all NULL
+};
+
+// Table in a binary columnar file, loaded with mmap: only the footer is read at load
+// time, cells are used in place and never parsed. Layout, in host byte order with every
+// section aligned to 8 bytes:
+//   "WHERECOL"
+//   per column: validity bitmap (64-bit words, bit set when the cell is not NULL), then
+//               int32 or float per row, or for strings uint64 offsets[rows + 1] and the bytes;
+//               INT columns whose range fits in 31 bits are bit packed instead (PackedColumn);
+//               columns with long runs of equal cells store uint64 run ends, then the run
+//               values as a column of their own (RleColumn)
+//   footer:     row count, column count, and per column its name and descriptor: type,
+//               encoding, packed width and base, section offsets, NULL count, min and max,
+//               and for run length encoding the run count and the run values' descriptor
+//   footer offset (uint64), "WHERECOL"
+// A column is stored as INT or FLOAT only when every cell prints back to the same text,
+// so string conditions on it see exactly the original cells.
+class ColumnFile: public ColumnTable
+{
+private:
+    static const uint64_t MAGIC = 0x4c4f434552454857ULL; // "WHERECOL"
+
+    // Column encodings
+    static const uint32_t PLAIN  = 0;
+    static const uint32_t PACKED = 1;
+    static const uint32_t RLE    = 2;
+
+    // Run length encode a column when its runs average at least this many rows.
+    static const size_t RUN = 16;
+
+    const char* data;
+    size_t      length;
+#ifdef _WIN32
+    std::vector<char> buffer;
+#endif
+    size_t      nrows;
+    header_t    header;
+    std::vector<Column*>       columns;
+    std::vector<ColumnStats>   stats;
+
+    // Words of a packed column: whole blocks, since a scan unpacks all 64 values of the
+    // last one, and two spare words, since unpacking reads one word past the value even
+    // at width 0.
+    static size_t packedWords(size_t rows, unsigned width)
+    {
+        return (rows + 63) / 64 * width + 2;
+    }
+
+    static void pad(std::ostream& out, uint64_t& offset)
+    {
+        static const char zeros[8] = {0};
+        size_t n = (size_t)((8 - offset % 8) % 8);
+        out.write(zeros, n);
+        offset += n;
+    }
+
+    static void put(std::ostream& out, uint64_t& offset, const void* bytes, size_t n)
+    {
+        out.write((const char*)bytes, n);
+        offset += n;
+    }
+
+    template <typename V>
+    static void append(std::string& buf, const V& val)
+    {
+        buf.append((const char*)&val, sizeof(V));
+    }
+
+    // Bounds checked read from the length bytes at p, i.e. the footer.
+    template <typename V>
+    static V take(const char* p, size_t length, size_t& pos)
+    {
+        V val;
+        if (pos > length || sizeof(V) > length - pos)
+        {
+            throw std::runtime_error("corrupt column file");
+        }
+        std::memcpy(&val, p + pos, sizeof(V));
+        pos += sizeof(V);
+        return val;
+    }
+
+    // Pointer to the n bytes at offset of the length bytes at p, checked against the bounds.
+    static const char* section(const char* p, size_t length, uint64_t offset, uint64_t n)
+    {
+        if (offset % 8 || offset > length || n > length - offset)
+        {
+            throw std::runtime_error("corrupt column file");
+        }
+        return p + offset;
+    }
+
+    // The narrowest type all non-NULL cells convert to and back without loss.
+    static int typeOf(const std::vector<const std::string*>& cells)
+    {
+        bool ints = true;
+        bool floats = true;
+        for (size_t r = 0; r < cells.size() && (ints || floats); r++)
+        {
+            const std::string& cell = *cells[r];
+            if (cell.empty())
+            {
+                continue;
+            }
+            int i;
+            float f;
+            ints   = ints && parseCell(cell, i) && std::to_string(i) == cell;
+            floats = floats && parseCell(cell, f) && formatFloat(f) == cell
+                     && cell.find_first_of("eE") == std::string::npos; // int of 1e5 is 1
+        }
+        return ints ? Column::INT : floats ? Column::FLOAT : Column::STRING;
+    }
+
+    static ColumnStats writeColumn(std::ostream& out, uint64_t& offset, std::string& footer,
+                                   const std::vector<const std::string*>& cells, bool runs);
+    static Column* readColumn(const char* meta, size_t meta_length, size_t& pos,
+                              const char* data, size_t length, size_t rows, ColumnStats& st);
+    void load();
+    void release();
+
+    friend class RowGroupFile; // stores its chunks in the same encoding
+
+public:
+    // Map the file at path. Throws std::runtime_error if it cannot be read or is not a column file.
+    explicit ColumnFile(const std::string& path);
+    ~ColumnFile();
+
+    ColumnFile(const ColumnFile&) = delete;
+    ColumnFile& operator=(const ColumnFile&) = delete;
+
+    // Store a table as a column file. Throws std::runtime_error if path cannot be written.
+    static void Write(const std::string& path, header_t& header, table_t& table);
+
+    size_t rows() const { return nrows; }
+
+    const Column* column(const std::string& name) const
+    {
+        header_t::const_iterator it = header.find(name);
+        return it == header.end() ? NULL : columns[it->second];
+    }
+
+    const header_t& getHeader() const { return header; }
+
+    // Statistics of the named column, or NULL if there is none.
+    const ColumnStats* getStats(const std::string& name) const
+    {
+        header_t::const_iterator it = header.find(name);
+        return it == header.end() ? NULL : &stats[it->second];
+    }
+};
+
+// Write the sections of one column and append its descriptor to footer.
+inline ColumnStats ColumnFile::writeColumn(std::ostream& out, uint64_t& offset, std::string& footer,
+                                           const std::vector<const std::string*>& cells, bool runs)
+{
+    uint64_t rows = cells.size();
+    uint32_t kind = (uint32_t)typeOf(cells);
+    ColumnStats st;
+    st.nulls = 0;
+    st.min   = NAN;
+    st.max   = NAN;
+
+    std::vector<const std::string*> run_values;
+    std::vector<uint64_t> run_ends;
+    for (size_t r = 0; runs && r < rows; r++)
+    {
+        if (r == 0 || *cells[r] != *cells[r - 1])
+        {
+            run_values.push_back(cells[r]);
+            run_ends.push_back(r);
+        }
+        run_ends.back() = r + 1;
+    }
+    if (runs && rows && run_values.size() * RUN <= rows)
+    {
+        for (size_t r = 0; r < rows; r++)
+        {
+            st.nulls += cells[r]->empty();
+        }
+        uint64_t ends = offset;
+        put(out, offset, run_ends.data(), run_ends.size() * sizeof(uint64_t));
+
+        append(footer, kind);
+        append(footer, (uint32_t)RLE);
+        append(footer, (uint32_t)0);
+        append(footer, (int64_t)0);
+        append(footer, (uint64_t)0);
+        append(footer, ends);
+        append(footer, (uint64_t)0);
+        size_t stats = footer.size(); // min and max are those of the run values, patched below
+        append(footer, (uint64_t)st.nulls);
+        append(footer, st.min);
+        append(footer, st.max);
+        append(footer, (uint64_t)run_values.size());
+
+        ColumnStats values = writeColumn(out, offset, footer, run_values, false);
+        st.min = values.min;
+        st.max = values.max;
+        std::memcpy(&footer[stats + sizeof(uint64_t)], &st.min, sizeof(double));
+        std::memcpy(&footer[stats + sizeof(uint64_t) + sizeof(double)], &st.max, sizeof(double));
+        return st;
+    }
+
+    std::vector<uint64_t> valid((rows + 63) / 64, 0);
+    for (size_t r = 0; r < rows; r++)
+    {
+        if (cells[r]->empty())
+        {
+            st.nulls++;
+        }
+        else
+        {
+            valid[r >> 6] |= 1ULL << (r & 63);
+        }
+    }
+    uint64_t validity = offset;
+    put(out, offset, valid.data(), valid.size() * sizeof(uint64_t));
+
+    uint64_t values   = offset;
+    uint64_t blob     = 0;
+    uint32_t encoding = PLAIN;
+    uint32_t width    = 0;
+    long long base    = 0;
+    if (kind == Column::INT || kind == Column::FLOAT)
+    {
+        std::vector<int32_t> ints(kind == Column::INT ? rows : 0, 0);
+        std::vector<float> floats(kind == Column::FLOAT ? rows : 0, 0.0f);
+        for (size_t r = 0; r < rows; r++)
+        {
+            double v;
+            if (kind == Column::INT)
+            {
+                int i;
+                if (!parseCell(*cells[r], i)) continue;
+                ints[r] = i;
+                v = i;
+            }
+            else
+            {
+                float f;
+                if (!parseCell(*cells[r], f)) continue;
+                floats[r] = f;
+                v = f;
+            }
+            if (std::isnan(v))
+            {
+                continue; // a NaN cell compares false to everything, keep it out of the range
+            }
+            st.min = std::isnan(st.min) ? v : std::min(st.min, v);
+            st.max = std::isnan(st.max) ? v : std::max(st.max, v);
+        }
+        if (kind == Column::INT && rows > st.nulls)
+        {
+            base = (long long)st.min;
+            uint64_t range = (uint64_t)((long long)st.max - base);
+            while (range >> width)
+            {
+                width++;
+            }
+        }
+        if (kind == Column::INT && width < 32)
+        {
+            // Block b of 64 rows starts at word b * width.
+            encoding = PACKED;
+            std::vector<uint64_t> packed(packedWords(rows, width), 0);
+            for (size_t r = 0; r < rows; r++)
+            {
+                uint64_t code = cells[r]->empty() ? 0 : (uint64_t)((long long)ints[r] - base);
+                size_t bit = r * width;
+                packed[bit >> 6] |= code << (bit & 63);
+                if ((bit & 63) + width > 64)
+                {
+                    packed[(bit >> 6) + 1] |= code >> (64 - (bit & 63));
+                }
+            }
+            put(out, offset, packed.data(), packed.size() * sizeof(uint64_t));
+        }
+        else if (kind == Column::INT)
+        {
+            put(out, offset, ints.data(), ints.size() * sizeof(int32_t));
+        }
+        else
+        {
+            put(out, offset, floats.data(), floats.size() * sizeof(float));
+        }
+    }
+    else
+    {
+        std::vector<uint64_t> offsets(rows + 1, 0);
+        for (size_t r = 0; r < rows; r++)
+        {
+            offsets[r + 1] = offsets[r] + cells[r]->size();
+        }
+        put(out, offset, offsets.data(), offsets.size() * sizeof(uint64_t));
+        blob = offset;
+        for (size_t r = 0; r < rows; r++)
+        {
+            put(out, offset, cells[r]->data(), cells[r]->size());
+        }
+    }
+    pad(out, offset);
+
+    append(footer, kind);
+    append(footer, encoding);
+    append(footer, width);
+    append(footer, (int64_t)base);
+    append(footer, validity);
+    append(footer, values);
+    append(footer, blob);
+    append(footer, (uint64_t)st.nulls);
+    append(footer, st.min);
+    append(footer, st.max);
+    return st;
+}
+
+inline void ColumnFile::Write(const std::string& path, header_t& header, table_t& table)
+{
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out)
+    {
+        throw std::runtime_error("cannot write " + path);
+    }
+
+    std::vector<std::string> names(header.size());
+    for (header_t::const_iterator it = header.begin(); it != header.end(); it++)
+    {
+        names[it->second] = it->first;
+    }
+
+    uint64_t magic  = MAGIC;
+    uint64_t rows   = table.size();
+    uint64_t offset = 0;
+    put(out, offset, &magic, sizeof(magic));
+
+    std::string footer;
+    append(footer, rows);
+    append(footer, (uint32_t)names.size());
+    std::vector<const std::string*> cells(rows);
+    for (size_t c = 0; c < names.size(); c++)
+    {
+        for (size_t r = 0; r < rows; r++)
+        {
+            cells[r] = &table[r][c];
+        }
+        append(footer, (uint32_t)names[c].size());
+        footer += names[c];
+        writeColumn(out, offset, footer, cells, true);
+    }
+
+    uint64_t footer_offset = offset;
+    put(out, offset, footer.data(), footer.size());
+    put(out, offset, &footer_offset, sizeof(footer_offset));
+    put(out, offset, &magic, sizeof(magic));
+    if (!out)
+    {
+        throw std::runtime_error("cannot write " + path);
+    }
+}
+
+inline ColumnFile::ColumnFile(const std::string& path)
+{
+    data   = NULL;
+    length = 0;
+    nrows  = 0;
+
+#ifdef _WIN32
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in)
+    {
+        throw std::runtime_error("cannot open " + path);
+    }
+    buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    data   = buffer.data();
+    length = buffer.size();
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("cannot open " + path);
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        length = (size_t)st.st_size;
+        map    = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd); // the mapping stays valid
+    if (map == MAP_FAILED)
+    {
+        throw std::runtime_error("cannot map " + path);
+    }
+    data = (const char*)map;
+#endif
+
+    try
+    {
+        load();
+    }
+    catch (...)
+    {
+        release();
+        throw;
+    }
+}
+
+inline ColumnFile::~ColumnFile()
+{
+    release();
+}
+
+inline void ColumnFile::release()
+{
+    for (size_t i = 0; i < columns.size(); i++)
+    {
+        delete columns[i];
+    }
+    columns.clear();
+#ifndef _WIN32
+    if (data)
+    {
+        munmap((void*)data, length);
+    }
+#endif
+    data = NULL;
+}
+
+// Read the footer and point the columns into the mapping. The cells themselves are not
+// touched, so loading costs the same for any table size.
+inline void ColumnFile::load()
+{
+    size_t pos = 0;
+    if (length < 3 * sizeof(uint64_t) || take<uint64_t>(data, length, pos) != MAGIC)
+    {
+        throw std::runtime_error("not a column file");
+    }
+    pos = length - 2 * sizeof(uint64_t);
+    size_t footer = (size_t)take<uint64_t>(data, length, pos);
+    if (take<uint64_t>(data, length, pos) != MAGIC || footer > length)
+    {
+        throw std::runtime_error("not a column file");
+    }
+
+    pos = footer;
+    nrows = (size_t)take<uint64_t>(data, length, pos);
+    uint32_t ncols = take<uint32_t>(data, length, pos);
+    if (nrows >> 56) // rows may exceed the file size with runs, but not by that much
+    {
+        throw std::runtime_error("corrupt column file");
+    }
+
+    for (uint32_t c = 0; c < ncols; c++)
+    {
+        uint32_t size = take<uint32_t>(data, length, pos);
+        if (size > length - pos)
+        {
+            throw std::runtime_error("corrupt column file");
+        }
+        std::string name(data + pos, size);
+        pos += size;
+
+        ColumnStats st;
+        header[name] = (int)c;
+        columns.push_back(readColumn(data, length, pos, data, length, nrows, st));
+        stats.push_back(st);
+    }
+}
+
+// Column of rows rows from the descriptor at pos in meta, with its sections in data.
+inline Column* ColumnFile::readColumn(const char* meta, size_t meta_length, size_t& pos,
+                                      const char* data, size_t length, size_t rows, ColumnStats& st)
+{
+    uint32_t kind     = take<uint32_t>(meta, meta_length, pos);
+    uint32_t encoding = take<uint32_t>(meta, meta_length, pos);
+    uint32_t width    = take<uint32_t>(meta, meta_length, pos);
+    int64_t  base     = take<int64_t>(meta, meta_length, pos);
+    uint64_t validity = take<uint64_t>(meta, meta_length, pos);
+    uint64_t values   = take<uint64_t>(meta, meta_length, pos);
+    uint64_t blob     = take<uint64_t>(meta, meta_length, pos);
+    st.nulls = (size_t)take<uint64_t>(meta, meta_length, pos);
+    st.min   = take<double>(meta, meta_length, pos);
+    st.max   = take<double>(meta, meta_length, pos);
+
+    if (encoding == RLE)
+    {
+        // Only the last run end is checked, like string offsets below.
+        uint64_t runs = take<uint64_t>(meta, meta_length, pos);
+        if (runs > rows || (rows && !runs))
+        {
+            throw std::runtime_error("corrupt column file");
+        }
+        const uint64_t* ends = (const uint64_t*)section(data, length, values, runs * sizeof(uint64_t));
+        if (runs && ends[runs - 1] != rows)
+        {
+            throw std::runtime_error("corrupt column file");
+        }
+        ColumnStats run_stats;
+        Column* run_values = readColumn(meta, meta_length, pos, data, length, (size_t)runs, run_stats);
+        if (run_values->type() != (int)kind || run_values->runValues())
+        {
+            delete run_values;
+            throw std::runtime_error("corrupt column file");
+        }
+        return new RleColumn(rows, (size_t)runs, ends, run_values);
+    }
+
+    size_t words = (rows + 63) / 64;
+    const uint64_t* valid = (const uint64_t*)section(data, length, validity, words * sizeof(uint64_t));
+    if (encoding == PACKED && kind == Column::INT && width < 32)
+    {
+        const char* cells = section(data, length, values, packedWords(rows, width) * sizeof(uint64_t));
+        return new PackedColumn(rows, valid, (const uint64_t*)cells, base, width);
+    }
+    if (encoding != PLAIN)
+    {
+        throw std::runtime_error("corrupt column file");
+    }
+    if (kind == Column::INT || kind == Column::FLOAT)
+    {
+        return new MappedColumn((int)kind, rows, valid, section(data, length, values, rows * 4), NULL);
+    }
+    if (kind == Column::STRING)
+    {
+        const char* cells = section(data, length, values, (rows + 1) * sizeof(uint64_t));
+        // Only the total is checked; offsets in between are trusted, reading them all
+        // would touch every page of the column.
+        if (blob > length || ((const uint64_t*)cells)[rows] > length - blob)
+        {
+            throw std::runtime_error("corrupt column file");
+        }
+        return new MappedColumn((int)kind, rows, valid, cells, data + blob);
+    }
+    throw std::runtime_error("corrupt column file");
+}
+
+// One row group of a RowGroupFile in memory, holding just the columns that were read.
+class RowGroup: public ColumnTable
+{
+private:
+    size_t nrows;
+    std::map<std::string, Column*> columns;           // owned
+    std::vector<std::vector<uint64_t> > buffers;      // the chunks the columns point into
+
+public:
+    explicit RowGroup(size_t rows)
+    {
+        nrows = rows;
+    }
+
+    ~RowGroup()
+    {
+        for (std::map<std::string, Column*>::iterator it = columns.begin(); it != columns.end(); it++)
+        {
+            delete it->second;
+        }
+    }
+
+    RowGroup(const RowGroup&) = delete;
+    RowGroup& operator=(const RowGroup&) = delete;
+
+    // Take ownership of a column and the buffer it was decoded from.
+    void Add(const std::string& name, Column* column, std::vector<uint64_t>& buffer)
+    {
+        columns[name] = column;
+        buffers.push_back(std::vector<uint64_t>());
+        buffers.back().swap(buffer);
+    }
+
+    size_t rows() const { return nrows; }
+
+    const Column* column(const std::string& name) const
+    {
+        std::map<std::string, Column*>::const_iterator it = columns.find(name);
+        return it == columns.end() ? NULL : it->second;
+    }
+};
+
+// Table split into row groups of a fixed number of rows, each column of each group stored
+// as a chunk in the ColumnFile encoding, for reading with pushdown instead of mmap. The
+// footer keeps per chunk its NULL count, min, max and a Bloom filter of the cells, so for
+// a given clause the reader skips whole row groups no row of which can pass, and reads
+// only the chunks of the columns the clause and the projection use. Layout:
+//   "WHERERGF"
+//   per row group, per column: the chunk (offsets inside it are relative to its start),
+//               then its Bloom filter words
+//   footer:     row count, column names, group count, and per group its row count and per
+//               column the chunk offset and size, Bloom offset and size, NULL count, min,
+//               max, and the chunk's ColumnFile descriptor
+//   footer offset (uint64), "WHERERGF"
+// Groups are read ahead on a thread with plain pread, so the disk stays busy while the
+// clause is evaluated (see SetPrefetch).
+class RowGroupFile
+{
+private:
+    static const uint64_t MAGIC = 0x4647524552454857ULL; // "WHERERGF"
+
+    struct Chunk
+    {
+        uint64_t    offset;
+        uint64_t    size;
+        uint64_t    bloom;        // offset of the Bloom filter words
+        uint64_t    bloom_words;
+        int         kind;
+        ColumnStats stats;
+        std::string descriptor;   // ColumnFile column descriptor
+    };
+
+    struct Group
+    {
+        size_t rows;
+        std::vector<Chunk> chunks; // in column order
+    };
+
+#ifdef _WIN32
+    mutable std::ifstream in;
+#else
+    int fd;
+#endif
+    size_t   nrows;
+    header_t header;
+    std::vector<Group> groups;
+
+    size_t   prefetch;       // row groups read ahead, 0 = read on demand
+    size_t   groups_read;
+    size_t   groups_skipped;
+    uint64_t bytes_read;
+
+    // Read n bytes at offset, throwing std::runtime_error on a short read.
+    void readAt(void* buf, size_t n, uint64_t offset)
+    {
+#ifdef _WIN32
+        in.seekg((std::streamoff)offset);
+        if (!in.read((char*)buf, n))
+        {
+            in.clear();
+            throw std::runtime_error("short read");
+        }
+#else
+        size_t done = 0;
+        while (done < n)
+        {
+            ssize_t got = pread(fd, (char*)buf + done, n - done, (off_t)(offset + done));
+            if (got <= 0)
+            {
+                if (got < 0 && errno == EINTR) continue;
+                throw std::runtime_error("short read");
+            }
+            done += (size_t)got;
+        }
+#endif
+        bytes_read += n;
+    }
+
+    // False if the statistics of group g prove no row satisfies c.
+    bool mayMatch(const ConditionBase& c, const Group& g)
+    {
+        const ConditionBase* cond = c.unwrap();
+        header_t::const_iterator it = header.find(cond->getColumn());
+        if (it == header.end())
+        {
+            return cond->getOperator() == Operator::IS_NULL; // unknown column: NULL on every row
+        }
+        const Chunk& chunk = g.chunks[it->second];
+        const ColumnStats& st = chunk.stats;
+
+        operator_t op = cond->getOperator();
+        if (op == Operator::IS_NULL)
+        {
+            return st.nulls > 0;
+        }
+        if (op == Operator::IS_NOT_NULL || st.nulls == g.rows)
+        {
+            return st.nulls < g.rows; // every other comparison is UNKNOWN on NULL
+        }
+
+        // Conversions to int (truncation) and to float (rounding) keep the order of the
+        // values, so the converted min and max still bound the chunk.
+        double lo, hi;
+        if (chunk.kind != Column::STRING && !std::isnan(st.min))
+        {
+            if (rangeOf<int>(cond, lo, hi))
+            {
+                return lo <= std::trunc(st.max) && hi >= std::trunc(st.min);
+            }
+            if (rangeOf<float>(cond, lo, hi))
+            {
+                return lo <= (float)st.max && hi >= (float)st.min;
+            }
+        }
+
+        // Strings compare as the cell text, which is what the Bloom filter holds.
+        const Condition<std::string>* text = dynamic_cast<const Condition<std::string>*>(cond);
+        if (text && (op == Operator::EQ || op == Operator::IN))
+        {
+            std::vector<uint32_t> words((size_t)chunk.bloom_words);
+            readAt(words.data(), words.size() * sizeof(uint32_t), chunk.bloom);
+            BloomFilter bloom(words);
+
+            std::vector<std::string> keys(1, text->getValue());
+            if (op == Operator::IN)
+            {
+                keys = static_cast<const InCondition<std::string>*>(text)->getValues();
+            }
+            for (size_t k = 0; k < keys.size(); k++)
+            {
+                if (bloom.mayContain(keys[k]))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+        return true;
+    }
+
+    // False if no AND group of the clause can match a row of group g.
+    bool mayMatch(const std::vector<std::vector<ConditionBase*> >& conjunctions, const Group& g)
+    {
+        for (size_t i = 0; i < conjunctions.size(); i++)
+        {
+            bool possible = true;
+            for (size_t j = 0; j < conjunctions[i].size() && possible; j++)
+            {
+                possible = mayMatch(*conjunctions[i][j], g);
+            }
+            if (possible)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Row group g with the needed columns read, or NULL if its statistics rule out the clause.
+    std::shared_ptr<RowGroup> fetch(size_t g, const std::vector<std::vector<ConditionBase*> >& conjunctions,
+                                    const std::map<std::string, int>& needed)
+    {
+        if (!mayMatch(conjunctions, groups[g]))
+        {
+            groups_skipped++;
+            return std::shared_ptr<RowGroup>();
+        }
+        groups_read++;
+
+        std::shared_ptr<RowGroup> rg(new RowGroup(groups[g].rows));
+        for (std::map<std::string, int>::const_iterator it = needed.begin(); it != needed.end(); it++)
+        {
+            readChunk(groups[g], it->second, it->first, *rg);
+        }
+        return rg;
+    }
+
+    // Columns to read: those of the clause and of the projection, by name.
+    std::map<std::string, int> neededColumns(const std::vector<std::vector<ConditionBase*> >& conjunctions,
+                                             const std::vector<std::string>& projection)
+    {
+        std::map<std::string, int> needed;
+        for (size_t i = 0; i < conjunctions.size(); i++)
+        {
+            for (size_t j = 0; j < conjunctions[i].size(); j++)
+            {
+                std::string name = conjunctions[i][j]->getColumn();
+                if (header.count(name)) needed[name] = header[name];
+            }
+        }
+        for (size_t i = 0; i < projection.size(); i++)
+        {
+            if (header.count(projection[i])) needed[projection[i]] = header[projection[i]];
+        }
+        return needed;
+    }
+
+    // Read and decode the chunk of column c of group g into rg.
+    void readChunk(const Group& g, int c, const std::string& name, RowGroup& rg)
+    {
+        const Chunk& chunk = g.chunks[c];
+        std::vector<uint64_t> buffer((size_t)(chunk.size + 7) / 8);
+        readAt(buffer.data(), (size_t)chunk.size, chunk.offset);
+
+        size_t pos = 0;
+        ColumnStats st;
+        Column* column = ColumnFile::readColumn(chunk.descriptor.data(), chunk.descriptor.size(), pos,
+                                                (const char*)buffer.data(), (size_t)chunk.size, g.rows, st);
+        rg.Add(name, column, buffer);
+    }
 
-// Base Condition class, to make sure all types of conditions can be invoked using the same base type.
-class ConditionBase
-{
 public:
-    // A table class should be defined to encapsulate table header and table rows,
-    // then the function parameter could be (table, row_index).
-    virtual bool eval(header_t& header, row_t& row) = 0;
+    // Open the file at path and read its footer. Throws std::runtime_error if it cannot be
+    // read or is not a row group file.
+    explicit RowGroupFile(const std::string& path);
+    ~RowGroupFile();
 
-    virtual ~ConditionBase()
-    {
-        // nothing here, but required by polymorphism.
-    }
-};
+    RowGroupFile(const RowGroupFile&) = delete;
+    RowGroupFile& operator=(const RowGroupFile&) = delete;
 
-// Subclass for any type of conditions.
-template <typename T>
-class Condition: public ConditionBase
-{
-private:
-    std::string column;
-    operator_t op;
-    T value;
+    // Store a table in row groups of group_rows rows, with Bloom filters sized for fpp.
+    // Throws std::runtime_error if path cannot be written.
+    static void Write(const std::string& path, header_t& header, table_t& table,
+                      size_t group_rows = 65536, double fpp = 0.01);
 
-    bool getColumnValue(header_t& header, row_t& row, T& val)
+    // Read up to groups row groups ahead on an I/O thread while the clause is evaluated,
+    // so reading and evaluating overlap. 0 reads each group when it is needed.
+    RowGroupFile* SetPrefetch(size_t groups)
     {
-        val = row[header[column]];
-        return true;
+        this->prefetch = groups;
+        return this;
     }
 
-public:
-    // construct a new condition. i.e. name = "John Doe"
-    Condition(const std::string& column, operator_t op, const T& value)
+    size_t rows() const                 { return nrows; }
+    size_t groupCount() const           { return groups.size(); }
+    const header_t& getHeader() const   { return header; }
+
+    // EXPLAIN: which row groups select() would read for the clause, and how much of the
+    // file. Only statistics and Bloom filters are consulted, no column chunk is read.
+    std::string explain(Where& where, const std::vector<std::string>& columns = std::vector<std::string>())
     {
-        this->column = column;
-        this->op     = op;
-        this->value  = value;
+        std::unique_ptr<Where> plan = where.Plan();
+        std::vector<std::vector<ConditionBase*> > conjunctions = plan->groups();
+        std::map<std::string, int> needed = neededColumns(conjunctions, columns);
+        if (columns.empty())
+        {
+            needed = header;
+        }
+
+        size_t kept = 0;
+        uint64_t bytes = 0, total = 0;
+        for (size_t g = 0; g < groups.size(); g++)
+        {
+            bool read = mayMatch(conjunctions, groups[g]);
+            kept += read;
+            for (size_t c = 0; c < groups[g].chunks.size(); c++)
+            {
+                total += groups[g].chunks[c].size;
+            }
+            for (std::map<std::string, int>::const_iterator it = needed.begin(); read && it != needed.end(); it++)
+            {
+                bytes += groups[g].chunks[it->second].size;
+            }
+        }
+
+        std::ostringstream s;
+        s << plan->explain()
+          << "access: zone maps (min/max, NULL counts, Bloom filters) prune row groups: "
+          << groups.size() - kept << " of " << groups.size() << " pruned, " << kept << " read\n"
+          << "read: " << bytes << " of " << total << " bytes, columns";
+        for (std::map<std::string, int>::const_iterator it = needed.begin(); it != needed.end(); it++)
+        {
+            s << ' ' << it->first;
+        }
+        s << "\n" << "evaluation: columnar, one condition at a time over each row group";
+        if (prefetch)
+        {
+            s << ", " << prefetch << " groups read ahead";
+        }
+        s << '\n';
+        return s.str();
     }
 
-    bool eval(header_t& header, row_t& row)
+    // SELECT columns WHERE clause, in file order. Without columns, every column is returned.
+    table_t select(Where& where, const std::vector<std::string>& columns = std::vector<std::string>())
     {
-        bool result;
-        T val;
-        if (getColumnValue(header, row, val))
+        std::unique_ptr<Where> plan = where.Plan();
+        std::vector<std::vector<ConditionBase*> > conjunctions = plan->groups();
+
+        std::vector<std::string> projection = columns;
+        if (projection.empty())
         {
-            switch(op)
+            projection.resize(header.size());
+            for (header_t::const_iterator it = header.begin(); it != header.end(); it++)
             {
-                case Operator::EQ: result = (val == value); break;
-                case Operator::NE: result = (val != value); break;
-                case Operator::LT: result = (val <  value); break;
-                case Operator::LE: result = (val <= value); break;
-                case Operator::GT: result = (val >  value); break;
-                case Operator::GE: result = (val >= value); break;
-                default:           result = false;          break;
+                projection[it->second] = it->first;
             }
         }
-        else // conversion error
+
+        std::map<std::string, int> needed = neededColumns(conjunctions, projection);
+
+        table_t result;
+        auto consume = [&](const RowGroup& rg)
         {
-            result = false;
+            std::vector<const Column*> cols(projection.size());
+            for (size_t i = 0; i < projection.size(); i++)
+            {
+                cols[i] = rg.column(projection[i]);
+            }
+
+            Bitmap hits = plan->select(rg);
+            for (size_t r = hits.next(0); r < hits.size(); r = hits.next(r + 1))
+            {
+                row_t row(cols.size());
+                for (size_t i = 0; i < cols.size(); i++)
+                {
+                    if (cols[i]) cols[i]->get(r, row[i]);
+                }
+                result.push_back(row);
+            }
+        };
+
+        if (prefetch == 0)
+        {
+            for (size_t g = 0; g < groups.size(); g++)
+            {
+                std::shared_ptr<RowGroup> rg = fetch(g, conjunctions, needed);
+                if (rg)
+                {
+                    consume(*rg);
+                }
+            }
+            return result;
         }
 
-        // Debug
-        // std::cout << "#Debug: "
-        //           << column << ' ' << Operator::toString(op) << ' ' << value
-        //           << " -> " << column << " = " << val << " -> "
-        //           << (result ? "true" : "false") << std::endl;
+        // Read ahead on an I/O thread: while one group is evaluated here, the next ones are
+        // read, up to prefetch groups waiting.
+        std::mutex lock;
+        std::condition_variable changed;
+        std::list<std::shared_ptr<RowGroup> > ready;
+        bool done = false;
+        bool cancelled = false;
+        std::exception_ptr error;
+
+        std::thread reader([&]()
+        {
+            try
+            {
+                for (size_t g = 0; g < groups.size(); g++)
+                {
+                    std::shared_ptr<RowGroup> rg = fetch(g, conjunctions, needed);
+                    if (!rg)
+                    {
+                        continue;
+                    }
+                    std::unique_lock<std::mutex> guard(lock);
+                    changed.wait(guard, [&]() { return ready.size() < prefetch || cancelled; });
+                    if (cancelled)
+                    {
+                        break;
+                    }
+                    ready.push_back(rg);
+                    changed.notify_all();
+                }
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            done = true;
+            changed.notify_all();
+        });
+
+        try
+        {
+            while (true)
+            {
+                std::shared_ptr<RowGroup> rg;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    changed.wait(guard, [&]() { return !ready.empty() || done; });
+                    if (ready.empty())
+                    {
+                        break;
+                    }
+                    rg = ready.front();
+                    ready.pop_front();
+                    changed.notify_all();
+                }
+                consume(*rg);
+            }
+        }
+        catch (...)
+        {
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                cancelled = true;
+                changed.notify_all();
+            }
+            reader.join();
+            throw;
+        }
 
+        reader.join();
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
         return result;
     }
+
+    // Pushdown counters, since the file was opened. Only read them between selects.
+    size_t groupsRead() const    { return groups_read; }
+    size_t groupsSkipped() const { return groups_skipped; }
+    uint64_t bytesRead() const   { return bytes_read; }   // footer included
 };
 
-// Handle integer
-template <>
-bool Condition<int>::getColumnValue(header_t& header, row_t& row, int &val)
+inline void RowGroupFile::Write(const std::string& path, header_t& header, table_t& table,
+                                size_t group_rows, double fpp)
 {
-    try
+    std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!out || group_rows == 0)
     {
-        val = std::stoi(row[header[column]]);
+        throw std::runtime_error("cannot write " + path);
     }
-    catch(const std::invalid_argument& e)
+
+    std::vector<std::string> names(header.size());
+    for (header_t::const_iterator it = header.begin(); it != header.end(); it++)
     {
-        return false;
+        names[it->second] = it->first;
     }
-    catch(const std::out_of_range& e)
+
+    uint64_t magic  = MAGIC;
+    uint64_t rows   = table.size();
+    uint64_t offset = 0;
+    ColumnFile::put(out, offset, &magic, sizeof(magic));
+
+    std::string footer;
+    ColumnFile::append(footer, rows);
+    ColumnFile::append(footer, (uint32_t)names.size());
+    for (size_t c = 0; c < names.size(); c++)
     {
-        return false;
+        ColumnFile::append(footer, (uint32_t)names[c].size());
+        footer += names[c];
     }
+    ColumnFile::append(footer, (uint64_t)((rows + group_rows - 1) / group_rows));
 
-    return true;
+    std::vector<const std::string*> cells;
+    for (size_t begin = 0; begin < rows; begin += group_rows)
+    {
+        size_t end = std::min((size_t)rows, begin + group_rows);
+        ColumnFile::append(footer, (uint64_t)(end - begin));
+        for (size_t c = 0; c < names.size(); c++)
+        {
+            std::unordered_set<std::string> distinct;
+            cells.clear();
+            for (size_t r = begin; r < end; r++)
+            {
+                cells.push_back(&table[r][c]);
+                if (!table[r][c].empty()) distinct.insert(table[r][c]);
+            }
+
+            std::ostringstream chunk(std::ios::binary);
+            uint64_t size = 0;
+            std::string descriptor;
+            ColumnStats st = ColumnFile::writeColumn(chunk, size, descriptor, cells, true);
+            uint64_t chunk_offset = offset;
+            ColumnFile::put(out, offset, chunk.str().data(), (size_t)size);
+
+            BloomFilter bloom(BloomFilter::bytesFor(distinct.size(), fpp));
+            for (std::unordered_set<std::string>::const_iterator it = distinct.begin(); it != distinct.end(); it++)
+            {
+                bloom.add(*it);
+            }
+            uint64_t bloom_offset = offset;
+            const std::vector<uint32_t>& words = bloom.getWords();
+            ColumnFile::put(out, offset, words.data(), words.size() * sizeof(uint32_t));
+            ColumnFile::pad(out, offset);
+
+            ColumnFile::append(footer, chunk_offset);
+            ColumnFile::append(footer, size);
+            ColumnFile::append(footer, bloom_offset);
+            ColumnFile::append(footer, (uint64_t)words.size());
+            ColumnFile::append(footer, (uint64_t)st.nulls);
+            ColumnFile::append(footer, st.min);
+            ColumnFile::append(footer, st.max);
+            ColumnFile::append(footer, (uint32_t)descriptor.size());
+            footer += descriptor;
+        }
+    }
+
+    uint64_t footer_offset = offset;
+    ColumnFile::put(out, offset, footer.data(), footer.size());
+    ColumnFile::put(out, offset, &footer_offset, sizeof(footer_offset));
+    ColumnFile::put(out, offset, &magic, sizeof(magic));
+    if (!out)
+    {
+        throw std::runtime_error("cannot write " + path);
+    }
 }
 
-// Handle floating point number
-template <>
-bool Condition<float>::getColumnValue(header_t& header, row_t& row, float &val)
+inline RowGroupFile::RowGroupFile(const std::string& path)
 {
-    try
+    nrows          = 0;
+    prefetch       = 2;
+    groups_read    = 0;
+    groups_skipped = 0;
+    bytes_read     = 0;
+
+    uint64_t size = 0;
+#ifdef _WIN32
+    in.open(path.c_str(), std::ios::binary);
+    if (!in)
     {
-        val = (float)std::stod(row[header[column]]);
+        throw std::runtime_error("cannot open " + path);
     }
-    catch(const std::invalid_argument& e)
+    in.seekg(0, std::ios::end);
+    size = (uint64_t)in.tellg();
+#else
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
     {
-        return false;
+        throw std::runtime_error("cannot open " + path);
     }
-    catch(const std::out_of_range& e)
+    struct stat st;
+    if (fstat(fd, &st) == 0)
     {
-        return false;
+        size = (uint64_t)st.st_size;
     }
+#endif
 
-    return true;
+    try
+    {
+        uint64_t trailer[2];
+        if (size < 3 * sizeof(uint64_t))
+        {
+            throw std::runtime_error("not a row group file");
+        }
+        readAt(trailer, sizeof(trailer), size - sizeof(trailer));
+        if (trailer[1] != MAGIC || trailer[0] > size - sizeof(trailer))
+        {
+            throw std::runtime_error("not a row group file");
+        }
+
+        std::string footer((size_t)(size - sizeof(trailer) - trailer[0]), '\0');
+        readAt(&footer[0], footer.size(), trailer[0]);
+        const char* meta = footer.data();
+        size_t length = footer.size();
+        size_t pos = 0;
+
+        nrows = (size_t)ColumnFile::take<uint64_t>(meta, length, pos);
+        uint32_t ncols = ColumnFile::take<uint32_t>(meta, length, pos);
+        for (uint32_t c = 0; c < ncols; c++)
+        {
+            uint32_t n = ColumnFile::take<uint32_t>(meta, length, pos);
+            if (n > length - pos)
+            {
+                throw std::runtime_error("corrupt row group file");
+            }
+            header[std::string(meta + pos, n)] = (int)c;
+            pos += n;
+        }
+
+        uint64_t count = ColumnFile::take<uint64_t>(meta, length, pos);
+        size_t total = 0;
+        for (uint64_t g = 0; g < count; g++)
+        {
+            Group group;
+            group.rows = (size_t)ColumnFile::take<uint64_t>(meta, length, pos);
+            total += group.rows;
+            for (uint32_t c = 0; c < ncols; c++)
+            {
+                Chunk chunk;
+                chunk.offset       = ColumnFile::take<uint64_t>(meta, length, pos);
+                chunk.size         = ColumnFile::take<uint64_t>(meta, length, pos);
+                chunk.bloom        = ColumnFile::take<uint64_t>(meta, length, pos);
+                chunk.bloom_words  = ColumnFile::take<uint64_t>(meta, length, pos);
+                chunk.stats.nulls  = (size_t)ColumnFile::take<uint64_t>(meta, length, pos);
+                chunk.stats.min    = ColumnFile::take<double>(meta, length, pos);
+                chunk.stats.max    = ColumnFile::take<double>(meta, length, pos);
+                uint32_t n = ColumnFile::take<uint32_t>(meta, length, pos);
+                if (n < sizeof(uint32_t) || n > length - pos || chunk.offset > size || chunk.size > size - chunk.offset
+                    || chunk.bloom > size || chunk.bloom_words > (size - chunk.bloom) / sizeof(uint32_t))
+                {
+                    throw std::runtime_error("corrupt row group file");
+                }
+                chunk.descriptor.assign(meta + pos, n);
+                chunk.kind = (int)ColumnFile::take<uint32_t>(meta, length, pos); // descriptor starts with the type
+                pos += n - sizeof(uint32_t);
+                group.chunks.push_back(chunk);
+            }
+            groups.push_back(group);
+        }
+        if (total != nrows)
+        {
+            throw std::runtime_error("corrupt row group file");
+        }
+    }
+    catch (...)
+    {
+#ifndef _WIN32
+        close(fd);
+#endif
+        throw;
+    }
 }
 
-// Where Clause
-class Where
+inline RowGroupFile::~RowGroupFile()
 {
-private:
-    std::vector<ConditionBase*> conditions;  // all conditions in the clause
-    std::vector<operator_t>     operators;   // all operators in the clause
+#ifndef _WIN32
+    close(fd);
+#endif
+}
 
+// Rows passing a clause, pulled one at a time from their source, so a consumer handles
+// each match as it comes instead of collecting a result first:
+//     while (stream.next()) use(stream.row());
+// A stream runs its own plan of the clause (Where::Plan()); the clause must outlive it.
+class RowStream
+{
 public:
+    // Advance to the next matching row; false when there is none left.
+    virtual bool next() = 0;
 
-    ~Where()
+    // The current row, valid until the next call to next().
+    virtual const row_t& row() const = 0;
+
+    // Position of the current row in its source, counting from 0.
+    virtual size_t id() const = 0;
+
+    virtual const header_t& getHeader() const = 0;
+
+    virtual ~RowStream()
     {
-        for (size_t i = 0; i < conditions.size(); i++)
-        {
-            delete conditions[i];
-        }
+        // nothing here, but required by polymorphism.
     }
+};
 
-    Where* AddCondition(ConditionBase* c)
+// Matching rows of an in-memory table, without copying them.
+class TableStream: public RowStream
+{
+private:
+    header_t& header;
+    table_t&  table;
+    std::unique_ptr<Where> plan;
+    size_t    position; // next row to look at
+    size_t    current;
+
+public:
+    TableStream(header_t& header, table_t& table, Where& where)
+        : header(header), table(table), plan(where.Plan())
     {
-        conditions.push_back(c);
-        return this;
+        position = 0;
+        current  = 0;
     }
 
-    Where* AddOperator(operator_t op)
+    bool next()
     {
-        operators.push_back(op);
-        return this;
+        while (position < table.size())
+        {
+            size_t i = position++;
+            if (plan->eval(header, table[i]))
+            {
+                current = i;
+                return true;
+            }
+        }
+        return false;
     }
 
-    // A table class should be defined to encapsulate table header and table rows,
-    // then the function parameter could be (table, row_index, op_index).
-    bool eval(header_t& header, row_t& row)
+    const row_t& row() const       { return table[current]; }
+    size_t id() const              { return current; }
+    const header_t& getHeader() const { return header; }
+};
+
+// Matching rows of CSV text (RFC 4180: quoted fields may hold separators, doubled quotes
+// and line breaks), read a record at a time. The first record names the columns; records
+// are padded or cut to that many fields.
+class CsvStream: public RowStream
+{
+private:
+    std::istream& in;
+    std::unique_ptr<Where> plan;
+    char          separator;
+    header_t      header;
+    row_t         current;
+    size_t        records;  // data records read so far
+
+    // Read one record into fields; false at the end of the input.
+    bool read(row_t& fields)
     {
-        bool result = conditions[0]->eval(header, row);
+        fields.clear();
+        std::string line;
+        if (!std::getline(in, line))
+        {
+            return false;
+        }
 
-        size_t op_index = 0;
-        while(op_index < operators.size())
+        std::string field;
+        bool quoted = false;
+        for (size_t i = 0; ; i++)
         {
-            if (operators[op_index] == Operator::AND)
+            if (i == line.size())
             {
-                op_index++;
-
-                // If one operand of AND is false, skip :)
-                if (result)
-                {
-                    result = conditions[op_index]->eval(header, row);
-                }
-                else
+                if (quoted && std::getline(in, line)) // the field goes on past a line break
                 {
+                    field += '\n';
+                    i = (size_t)-1;
                     continue;
                 }
+                break;
             }
-            else // OR
-            {
-                op_index++;
 
-                // If one operand of OR is true, stop here :)
-                if (result)
+            char c = line[i];
+            if (quoted && c == '"')
+            {
+                if (i + 1 < line.size() && line[i + 1] == '"')
                 {
-                    return true;
+                    field += line[++i]; // "" inside quotes
                 }
                 else
                 {
-                    result = conditions[op_index]->eval(header, row);
-                    continue;
+                    quoted = false;
                 }
             }
+            else if (quoted)
+            {
+                field += c;
+            }
+            else if (c == '"')
+            {
+                quoted = true;
+            }
+            else if (c == separator)
+            {
+                fields.push_back(field);
+                field.clear();
+            }
+            else if (c != '\r' || i + 1 != line.size()) // CRLF line ends
+            {
+                field += c;
+            }
         }
+        fields.push_back(field);
+        return true;
+    }
 
-        return result;
+public:
+    CsvStream(std::istream& in, Where& where, char separator = ',')
+        : in(in), plan(where.Plan())
+    {
+        this->separator = separator;
+        this->records   = 0;
+
+        row_t names;
+        read(names);
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            header[names[i]] = (int)i;
+        }
+    }
+
+    bool next()
+    {
+        while (read(current))
+        {
+            records++;
+            current.resize(header.size());
+            if (plan->eval(header, current))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const row_t& row() const       { return current; }
+    size_t id() const              { return records - 1; }
+    const header_t& getHeader() const { return header; }
+};
+
+// Matching rows of a column file. Nothing is evaluated up front: when next() runs out
+// of matches, the clause runs on the next BLOCK rows (Where::select on a row range) into
+// a bitmap of one bit per row, and rows are only built from the columns as they are
+// pulled. Stopping early leaves the rest of the file unread.
+class ColumnStream: public RowStream
+{
+private:
+    static const size_t BLOCK = 4096; // rows evaluated at once
+
+    const ColumnFile& file;
+    std::unique_ptr<Where> plan;
+    Bitmap  matches;  // of the block starting at begin
+    size_t  begin;
+    size_t  position; // next bit of matches to look at
+    size_t  current;
+    row_t   cells;
+    std::vector<const Column*> columns;
+
+public:
+    ColumnStream(const ColumnFile& file, Where& where)
+        : file(file), plan(where.Plan())
+    {
+        begin    = 0;
+        position = 0;
+        current  = 0;
+
+        const header_t& header = file.getHeader();
+        columns.resize(header.size());
+        cells.resize(header.size());
+        for (header_t::const_iterator it = header.begin(); it != header.end(); it++)
+        {
+            columns[it->second] = file.column(it->first);
+        }
+    }
+
+    bool next()
+    {
+        size_t i = matches.next(position);
+        while (i >= matches.size())
+        {
+            begin += matches.size();
+            if (begin >= file.rows())
+            {
+                matches  = Bitmap();
+                position = 0;
+                return false;
+            }
+            matches  = plan->select(file, begin, std::min(begin + BLOCK, file.rows()));
+            position = 0;
+            i = matches.next(0);
+        }
+        position = i + 1;
+        current  = begin + i;
+
+        for (size_t c = 0; c < columns.size(); c++)
+        {
+            if (!columns[c]->get(current, cells[c]))
+            {
+                cells[c].clear(); // NULL
+            }
+        }
+        return true;
     }
+
+    const row_t& row() const       { return cells; }
+    size_t id() const              { return current; }
+    const header_t& getHeader() const { return file.getHeader(); }
 };
 
+#ifndef WHERE_NO_MAIN
 int main()
 {
     header_t header {
@@ -240,18 +5765,21 @@ int main()
 
     std::cout << "name\t\tage\tgender\tscore\tcompany\n"
               << "---------+---------+---------+---------+---------+\n";
-    for (size_t i = 0; i < table.size(); i++)
+    // SELECT name, age, gender, score, company
+    Scan scan(header, table, *w);
+    scan.AddColumn("name")->AddColumn("age")->AddColumn("gender")->AddColumn("score")->AddColumn("company");
+
+    table_t result = scan.select();
+    for (size_t i = 0; i < result.size(); i++)
     {
-        if (w->eval(header, table[i]))
+        std::cout << result[i][0];
+        for (size_t j = 1; j < result[i].size(); j++)
         {
-            std::cout << table[i][0];
-            for (size_t j = 1; j < table[i].size(); j++)
-            {
-                std::cout << '\t' << table[i][j];
-            }
-            std::cout << std::endl;
+            std::cout << '\t' << result[i][j];
         }
+        std::cout << std::endl;
     }
 
     return 0;
 }
+#endif